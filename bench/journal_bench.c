@@ -0,0 +1,149 @@
+/* Benchmark of acknowledged registrations against a running mapper, for
+ * comparing it with and without a journal (-j). Each client loops over
+ * registering a new ID ("!ID:PORT") and then looking it up ("?ID"), waiting
+ * for the reply, which with a journal acknowledges that the registration is
+ * durable. Each client reuses a range of port numbers of its own, so the ID
+ * which last held a port number is deregistered ("-ID") along with the next
+ * registration, and the IDs left are deregistered at the end of the run.
+ *
+ * Build: gcc -O2 -pthread -o journal_bench bench/journal_bench.c
+ * Usage: journal_bench mapper clients seconds
+ */
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The maximum number of clients */
+#define MAX_CLIENTS 1024
+
+/* The state shared by every client */
+typedef struct {
+    /* The port which the mapper is listening on */
+    char* mapper;
+    /* The number of port numbers each client uses */
+    int numPorts;
+    /* Set once the benchmark's time is up */
+    _Atomic int finished;
+    /* The total number of acknowledged registrations */
+    _Atomic long numRegistrations;
+    /* The number of clients which failed */
+    _Atomic int numFailed;
+} Bench;
+
+/* The arguments of one client */
+typedef struct {
+    /* The benchmark the client belongs to */
+    Bench* bench;
+    /* The index of the client */
+    int index;
+} Client;
+
+int connect_to_mapper(char* mapper);
+void* run_client(void* vars);
+
+int main(int argc, char** argv) {
+    int numClients = argc == 4 ? atoi(argv[2]) : 0;
+    int seconds = argc == 4 ? atoi(argv[3]) : 0;
+    if (numClients < 1 || numClients > MAX_CLIENTS || seconds < 1) {
+        fprintf(stderr, "Usage: journal_bench mapper clients seconds\n");
+        return 1;
+    }
+    Bench bench = {argv[1], 65535 / numClients, 0, 0, 0};
+    Client clients[numClients];
+    pthread_t threadIds[numClients];
+    for (int i = 0; i < numClients; i++) {
+        clients[i] = (Client){&bench, i};
+        pthread_create(&threadIds[i], NULL, run_client, &clients[i]);
+    }
+    sleep(seconds);
+    atomic_store(&bench.finished, 1);
+    for (int i = 0; i < numClients; i++) {
+        pthread_join(threadIds[i], NULL);
+    }
+    if (atomic_load(&bench.numFailed)) {
+        fprintf(stderr, "%d clients failed\n", atomic_load(&bench.numFailed));
+        return 2;
+    }
+    printf("%d clients: %.1fk acknowledged registrations/s\n", numClients,
+            atomic_load(&bench.numRegistrations) / (double)seconds / 1000);
+    return 0;
+}
+
+/**
+ * Connects to the mapper listening on the given port of localhost.
+ * @param mapper - the port which the mapper is listening on.
+ * @return - the file descriptor of the connection, or -1 if it failed.
+ */
+int connect_to_mapper(char* mapper) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* address;
+    if (getaddrinfo("localhost", mapper, &hints, &address)) {
+        return -1;
+    }
+    int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fileDescriptor, address->ai_addr, address->ai_addrlen)) {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+    freeaddrinfo(address);
+    return fileDescriptor;
+}
+
+/**
+ * Registers and looks up IDs over a connection of its own until the
+ * benchmark's time is up.
+ * @param vars - the Client to run.
+ * @return - NULL.
+ */
+void* run_client(void* vars) {
+    Client* client = (Client*)vars;
+    Bench* bench = client->bench;
+    int fileDescriptor = connect_to_mapper(bench->mapper);
+    if (fileDescriptor == -1) {
+        atomic_fetch_add(&bench->numFailed, 1);
+        return NULL;
+    }
+    FILE* readStream = fdopen(fileDescriptor, "r");
+    FILE* writeStream = fdopen(dup(fileDescriptor), "w");
+    long numRegistrations = 0;
+    for (long i = 0; !atomic_load(&bench->finished); i++) {
+        int port = 1 + client->index * bench->numPorts + i % bench->numPorts;
+        if (i >= bench->numPorts) {
+            fprintf(writeStream, "-c%d_%ld\n", client->index,
+                    i - bench->numPorts);
+        }
+        fprintf(writeStream, "!c%d_%ld:%d\n?c%d_%ld\n", client->index, i,
+                port, client->index, i);
+        fflush(writeStream);
+        char reply[16];
+        if (!fgets(reply, sizeof(reply), readStream) || atoi(reply) != port) {
+            atomic_fetch_add(&bench->numFailed, 1);
+            break; // connection lost, or registration not applied
+        }
+        numRegistrations++;
+    }
+    atomic_fetch_add(&bench->numRegistrations, numRegistrations);
+    /* Deregister the IDs left, so their port numbers are free for a later
+     * run */
+    for (long i = numRegistrations > bench->numPorts ?
+            numRegistrations - bench->numPorts : 0; i < numRegistrations;
+            i++) {
+        fprintf(writeStream, "-c%d_%ld\n", client->index, i);
+    }
+    fprintf(writeStream, "?c%d_%ld\n", client->index, numRegistrations);
+    fflush(writeStream);
+    char reply[16];
+    fgets(reply, sizeof(reply), readStream);
+    fclose(readStream);
+    fclose(writeStream);
+    return NULL;
+}
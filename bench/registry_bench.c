@@ -0,0 +1,422 @@
+/* Benchmarks of the mapper's registry, run in-process against the code of
+ * mapper2310.c itself (which this file includes), so that they measure the
+ * registry rather than the network.
+ *
+ * Each port number belongs to at most one registration, so a registry can
+ * hold no more than 65535 registrations. Counts above that are synthetic,
+ * showing how the registry scales beyond anything a mapper can hold: to make
+ * room for them, the benchmarks release each port number as soon as it has
+ * been registered. The airport records, blocks and indices are unchanged by
+ * this, and the table of port numbers is a fixed 512KiB however many
+ * registrations there are.
+ *
+ * Build: gcc -O2 -pthread -o registry_bench bench/registry_bench.c
+ * Usage: registry_bench insert count
+ *        registry_bench array count
+ *        registry_bench shards count shards
+ *        registry_bench memory count
+ *        registry_bench frozen count
+ */
+#define main mapper_main
+#include "../mapper2310.c"
+#undef main
+
+/* The number of threads registering airports, and the number looking them
+ * up, in the shards benchmark */
+#define NUM_WRITERS 4
+#define NUM_LOOKERS 4
+
+/* The number of lookups timed by the frozen benchmark */
+#define NUM_LOOKUPS 4000000
+
+/* The state shared by the threads of the shards benchmark */
+typedef struct {
+    /* The registry being registered into */
+    Registry* registry;
+    /* The number of airports each writer registers */
+    int count;
+    /* Set once every writer has finished */
+    _Atomic int finished;
+    /* The total number of lookups made */
+    _Atomic long numLookups;
+} ShardsBench;
+
+/* The arguments of one thread of the shards benchmark */
+typedef struct {
+    /* The benchmark the thread belongs to */
+    ShardsBench* bench;
+    /* The index of the thread among its kind */
+    int index;
+} BenchThread;
+
+double get_seconds(void);
+size_t get_resident_bytes(void);
+void register_released(Registry* registry, char* airportName, int port);
+int* shuffle_order(int count);
+void bench_insert(int count);
+void bench_array(int count);
+void bench_shards(int count, int numShards);
+void* write_airports(void* vars);
+void* look_up_airports(void* vars);
+void bench_memory(int count);
+void bench_frozen(int count);
+double time_lookups(Registry* registry, int count, long* numFound);
+
+int main(int argc, char** argv) {
+    int count = argc >= 3 && is_integer(argv[2]) ? atoi(argv[2]) : 0;
+    if (argc == 3 && count > 0 && strcmp(argv[1], "insert") == 0) {
+        bench_insert(count);
+    } else if (argc == 3 && count > 0 && strcmp(argv[1], "array") == 0) {
+        bench_array(count);
+    } else if (argc == 4 && count > 0 && strcmp(argv[1], "shards") == 0 &&
+            is_integer(argv[3]) && atoi(argv[3]) >= 1 &&
+            atoi(argv[3]) <= MAX_SHARDS) {
+        bench_shards(count, atoi(argv[3]));
+    } else if (argc == 3 && count > 0 && strcmp(argv[1], "memory") == 0) {
+        bench_memory(count);
+    } else if (argc == 3 && count > 0 && strcmp(argv[1], "frozen") == 0) {
+        bench_frozen(count);
+    } else {
+        fprintf(stderr, "Usage: registry_bench insert count\n"
+                "       registry_bench array count\n"
+                "       registry_bench shards count shards\n"
+                "       registry_bench memory count\n"
+                "       registry_bench frozen count\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Returns the time elapsed on the monotonic clock.
+ * @return - the time in seconds.
+ */
+double get_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the resident set size of this process.
+ * @return - the number of bytes of this process held in memory.
+ */
+size_t get_resident_bytes(void) {
+    FILE* file = fopen("/proc/self/statm", "r");
+    size_t numPages = 0;
+    size_t numResident = 0;
+    if (!file || fscanf(file, "%zu %zu", &numPages, &numResident) != 2) {
+        fprintf(stderr, "Unable to read /proc/self/statm\n");
+        exit(2);
+    }
+    fclose(file);
+    return numResident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Registers an airport as "!ID:PORT" would, then releases its port number
+ * (see above).
+ * @param registry - the registry to register into.
+ * @param airportName - the ID of the airport.
+ * @param port - the port number to register it with.
+ */
+void register_released(Registry* registry, char* airportName, int port) {
+    char command[MAX_BATCH_CHARS + 1];
+    snprintf(command, sizeof(command), "%s:%d", airportName, port);
+    register_airports(command, registry);
+    atomic_store(&registry->ports[port], NULL);
+}
+
+/**
+ * Returns the numbers from 0 up to the given count in a shuffled order, the
+ * same order on every run.
+ * @param count - the number of numbers to shuffle.
+ * @return - the shuffled numbers, to be freed by the caller.
+ */
+int* shuffle_order(int count) {
+    int* order = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    srand(2310);
+    for (int i = count - 1; i > 0; i--) {
+        int other = rand() % (i + 1);
+        int swapped = order[i];
+        order[i] = order[other];
+        order[other] = swapped;
+    }
+    return order;
+}
+
+/**
+ * Times inserting the given number of airports, with distinct IDs in a
+ * shuffled order, one at a time into the sorted blocks of a single shard
+ * through add_airport. They are added to a single update, as a bulk
+ * registration's are, so this excludes the cost of publishing each
+ * registration (see bench_shards).
+ * @param count - the number of airports to insert.
+ */
+void bench_insert(int count) {
+    static Registry registry;
+    init_registry(&registry, 1);
+    int* order = shuffle_order(count);
+    Shard* shard = &registry.shards[0];
+    double start = get_seconds();
+    take_lock(&shard->lock);
+    Snapshot* update = begin_update(shard);
+    for (int i = 0; i < count; i++) {
+        char airportName[16];
+        char portNumber[MAX_PORT_CHARS + 1];
+        sprintf(airportName, "id%07d", order[i]);
+        int port = 1 + i % UINT16_MAX;
+        sprintf(portNumber, "%d", port);
+        add_airport(airportName, portNumber, &update, shard);
+        atomic_store(&registry.ports[port], NULL);
+    }
+    double elapsed = get_seconds() - start;
+    publish_update(update, shard);
+    release_lock(&shard->lock);
+    printf("%d shuffled inserts: %.2f us/insert (%.2f s)\n", count,
+            elapsed / count * 1e6, elapsed);
+    free(order);
+}
+
+/**
+ * Times the same inserts as bench_insert into the flat sorted array of
+ * airports which the registry used before its sorted blocks: each insert
+ * scans the array for its position, then shifts every later airport along
+ * by one, as add_airport then did. The airports are indexed by ID in a
+ * single shard's hash index, as they were then.
+ * @param count - the number of airports to insert.
+ */
+void bench_array(int count) {
+    static Registry registry;
+    init_registry(&registry, 1);
+    int* order = shuffle_order(count);
+    Shard* shard = &registry.shards[0];
+    Airport** airports = malloc(count * sizeof(Airport*));
+    int numAirports = 0;
+    double start = get_seconds();
+    for (int i = 0; i < count; i++) {
+        char airportName[16];
+        sprintf(airportName, "id%07d", order[i]);
+        if (get_airport(airportName, &registry)) {
+            continue; // id already exists
+        }
+        size_t nameLength = strlen(airportName);
+        Airport* airport = calloc(1, AIRPORT_SIZE(nameLength));
+        memcpy(airport->name, airportName, nameLength + 1);
+        airport->portNumber = 1 + i % UINT16_MAX;
+        int insertionIndex = 0;
+        while (insertionIndex < numAirports &&
+                strcmp(airportName, airports[insertionIndex]->name) >= 0) {
+            insertionIndex++;
+        }
+        for (int j = numAirports - 1; j >= insertionIndex; j--) {
+            airports[j + 1] = airports[j];
+        }
+        airports[insertionIndex] = airport;
+        numAirports++;
+        index_airport(airport, shard);
+    }
+    double elapsed = get_seconds() - start;
+    printf("%d shuffled inserts into an array: %.2f us/insert (%.2f s)\n",
+            count, elapsed / count * 1e6, elapsed);
+    for (int i = 0; i < numAirports; i++) {
+        free(airports[i]);
+    }
+    free(airports);
+    free(order);
+}
+
+/**
+ * Times NUM_WRITERS threads registering the given number of airports each,
+ * while NUM_LOOKERS threads look airports up, in a registry of the given
+ * number of shards.
+ * @param count - the number of airports each writer registers.
+ * @param numShards - the number of shards in the registry.
+ */
+void bench_shards(int count, int numShards) {
+    static Registry registry;
+    init_registry(&registry, numShards);
+    ShardsBench bench = {&registry, count, 0, 0};
+    BenchThread writers[NUM_WRITERS];
+    BenchThread lookers[NUM_LOOKERS];
+    pthread_t writerIds[NUM_WRITERS];
+    pthread_t lookerIds[NUM_LOOKERS];
+    double start = get_seconds();
+    for (int i = 0; i < NUM_LOOKERS; i++) {
+        lookers[i] = (BenchThread){&bench, i};
+        pthread_create(&lookerIds[i], NULL, look_up_airports, &lookers[i]);
+    }
+    for (int i = 0; i < NUM_WRITERS; i++) {
+        writers[i] = (BenchThread){&bench, i};
+        pthread_create(&writerIds[i], NULL, write_airports, &writers[i]);
+    }
+    for (int i = 0; i < NUM_WRITERS; i++) {
+        pthread_join(writerIds[i], NULL);
+    }
+    double elapsed = get_seconds() - start;
+    atomic_store(&bench.finished, 1);
+    for (int i = 0; i < NUM_LOOKERS; i++) {
+        pthread_join(lookerIds[i], NULL);
+    }
+    printf("shards=%d: %.0f registrations/s, %.2fM lookups/s\n", numShards,
+            NUM_WRITERS * (double)count / elapsed,
+            atomic_load(&bench.numLookups) / elapsed / 1e6);
+}
+
+/**
+ * Registers one writer's airports for the shards benchmark. Each writer
+ * takes its port numbers from its own range, so that releasing them never
+ * races with another writer's registrations.
+ * @param vars - the BenchThread of this writer.
+ * @return - NULL.
+ */
+void* write_airports(void* vars) {
+    BenchThread* thread = (BenchThread*)vars;
+    ShardsBench* bench = thread->bench;
+    int reader = register_reader(bench->registry);
+    int portRange = UINT16_MAX / NUM_WRITERS;
+    for (int i = 0; i < bench->count; i++) {
+        char airportName[24];
+        sprintf(airportName, "w%did%07d", thread->index, i);
+        enter_registry(bench->registry, reader);
+        register_released(bench->registry, airportName,
+                1 + thread->index * portRange + i % portRange);
+        leave_registry(bench->registry, reader);
+    }
+    return NULL;
+}
+
+/**
+ * Looks airports up for the shards benchmark until every writer has
+ * finished, asking for IDs which the writers register (or will register).
+ * @param vars - the BenchThread of this looker.
+ * @return - NULL.
+ */
+void* look_up_airports(void* vars) {
+    BenchThread* thread = (BenchThread*)vars;
+    ShardsBench* bench = thread->bench;
+    int reader = register_reader(bench->registry);
+    unsigned int seed = thread->index;
+    long numLookups = 0;
+    while (!atomic_load(&bench->finished)) {
+        for (int i = 0; i < 1000; i++) {
+            char airportName[24];
+            sprintf(airportName, "w%did%07d", rand_r(&seed) % NUM_WRITERS,
+                    rand_r(&seed) % bench->count);
+            enter_registry(bench->registry, reader);
+            get_airport(airportName, bench->registry);
+            leave_registry(bench->registry, reader);
+        }
+        numLookups += 1000;
+    }
+    atomic_fetch_add(&bench->numLookups, numLookups);
+    return NULL;
+}
+
+/**
+ * Measures the memory taken by airports with IDs of the form "idNNNNNN", as
+ * the growth in resident memory over an empty registry of the default number
+ * of shards: first as loaded from a registrations file (as with -l, which
+ * keeps one airport per port number, so at most 65535 of them), then as
+ * the given number of airports registered one at a time.
+ * @param count - the number of airports to register.
+ */
+void bench_memory(int count) {
+    int numLoaded = count < UINT16_MAX ? count : UINT16_MAX;
+    FILE* file = tmpfile();
+    for (int i = 0; i < numLoaded; i++) {
+        fprintf(file, "id%06d:%d\n", i, 1 + i);
+    }
+    rewind(file);
+    static Registry loaded;
+    init_registry(&loaded, DEFAULT_SHARDS);
+    size_t empty = get_resident_bytes();
+    load_airports(file, &loaded);
+    size_t full = get_resident_bytes();
+    fclose(file);
+    printf("%d loaded: %.1f bytes/registration\n", numLoaded,
+            (double)(full - empty) / numLoaded);
+
+    static Registry registered;
+    init_registry(&registered, DEFAULT_SHARDS);
+    empty = get_resident_bytes();
+    for (int i = 0; i < count; i++) {
+        char airportName[16];
+        sprintf(airportName, "id%06d", i);
+        register_released(&registered, airportName, 1 + i % UINT16_MAX);
+    }
+    full = get_resident_bytes();
+    printf("%d registered: %.1f bytes/registration (%.1f MB)\n", count,
+            (double)(full - empty) / count, (full - empty) / 1e6);
+}
+
+/**
+ * Compares lookups in a registry of the given number of airports (with IDs
+ * of the form "idNNNNNN", in the default number of shards) before and after
+ * freezing it, along with the memory of its index and the time taken to
+ * freeze it.
+ * @param count - the number of airports to register.
+ */
+void bench_frozen(int count) {
+    static Registry registry;
+    init_registry(&registry, DEFAULT_SHARDS);
+    for (int i = 0; i < count; i++) {
+        char airportName[16];
+        sprintf(airportName, "id%06d", i);
+        register_released(&registry, airportName, 1 + i % UINT16_MAX);
+    }
+    size_t indexBytes = 0;
+    for (int i = 0; i < registry.numShards; i++) {
+        Index* index = atomic_load(&registry.shards[i].index);
+        indexBytes += sizeof(Index) + index->capacity * sizeof(Airport*);
+    }
+    long numFound = 0;
+    double lookup = time_lookups(&registry, count, &numFound);
+    printf("dynamic: %.0f ns/lookup (%ld of %d found), index %.1f bytes/ID, "
+            "RSS %.1f MB\n", lookup * 1e9, numFound, NUM_LOOKUPS,
+            (double)indexBytes / count, get_resident_bytes() / 1e6);
+
+    static FrozenTable table;
+    double start = get_seconds();
+    if (freeze_registry(&table, &registry) == -1) {
+        fprintf(stderr, "Unable to freeze registry\n");
+        exit(3);
+    }
+    double freezing = get_seconds() - start;
+    indexBytes = table.numAirports * sizeof(Airport*) +
+            table.numBuckets * sizeof(uint32_t);
+    lookup = time_lookups(&registry, count, &numFound);
+    printf("frozen:  %.0f ns/lookup (%ld of %d found), index %.1f bytes/ID, "
+            "RSS %.1f MB, frozen in %.2f s\n", lookup * 1e9, numFound,
+            NUM_LOOKUPS, (double)indexBytes / count,
+            get_resident_bytes() / 1e6, freezing);
+}
+
+/**
+ * Times NUM_LOOKUPS lookups of IDs of the form "idNNNNNN", drawn from a
+ * quarter more IDs than are registered, so that about 80% of them are found.
+ * @param registry - the registry to look up.
+ * @param count - the number of airports registered.
+ * @param numFound - set to the number of lookups which found their airport.
+ * @return - the average time taken by a lookup, in seconds.
+ */
+double time_lookups(Registry* registry, int count, long* numFound) {
+    char (*airportNames)[16] = malloc(NUM_LOOKUPS * sizeof(*airportNames));
+    for (long i = 0; i < NUM_LOOKUPS; i++) {
+        sprintf(airportNames[i], "id%06ld", i * 7919 % (count + count / 4));
+    }
+    int reader = register_reader(registry);
+    *numFound = 0;
+    double start = get_seconds();
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+        enter_registry(registry, reader);
+        *numFound += get_airport(airportNames[i], registry) != NULL;
+        leave_registry(registry, reader);
+    }
+    double elapsed = get_seconds() - start;
+    free(airportNames);
+    return elapsed / NUM_LOOKUPS;
+}
@@ -6,6 +6,20 @@
 #include <semaphore.h>
 #include <ctype.h>
 #include <zconf.h>
+#include <time.h>
+
+/**
+ * Struct containing the load of this control, as the number of planes
+ * currently connected to it, which is reported to the mapper so that it can
+ * direct planes to the least loaded of several controls sharing an ID.
+ */
+typedef struct {
+    /* The number of planes currently connected */
+    int numConnected;
+    /* The lock taken to access numConnected, separate from the planes' lock
+     * since that is held by a plane's pthread once it has sent "log" */
+    sem_t lock;
+} Load;
 
 /**
  * Struct containing all arguments necessary to run a plane client in its own
@@ -23,13 +37,37 @@ typedef struct {
     /* The lock shared amongst pthreads to prevent simultaneous interactions
      * with the same memory */
     sem_t* lock;
+    /* This control's load */
+    Load* load;
 } PlanePackage;
 
+/**
+ * Struct containing all arguments necessary to keep this control's
+ * registration with a mapper alive in its own pthread.
+ */
+typedef struct {
+    /* The port through which to connect to the mapper */
+    char* mapperPort;
+    /* The id of this control */
+    char* id;
+    /* The port number this control is listening on */
+    in_port_t controlPort;
+    /* This control's load */
+    Load* load;
+} RegistrationPackage;
+
 char* read_line(FILE* stream);
 int contains_invalid_characters(char* string);
 int verify_message(char* string);
 int is_integer(char* string);
+FILE* connect_to_mapper(char* mapperPort);
 int send_info_to_mapper(char* mapperPort, char* id, in_port_t controlPort);
+int get_lease_time(char* mapperPort);
+int send_load_to_mapper(char* mapperPort, char* id, in_port_t controlPort,
+        int load);
+int get_load(Load* load);
+void change_load(Load* load, int change);
+void* renew_registration(void* var);
 void init_lock(sem_t* lock);
 void take_lock(sem_t* lock);
 void release_lock(sem_t* lock);
@@ -45,6 +83,10 @@ void accept_clients(PlanePackage defaultPackage, int serverFileDescriptor,
  * communications */
 #define MAX_CHARS 79
 
+/* The number of milliseconds between checks of whether this control's load
+ * has changed, and so should be reported to the mapper */
+#define LOAD_INTERVAL 1000
+
 int main(int argc, char** argv) {
     // the maximum number of planes this control can connect to
     size_t maxPlanes = 1000;
@@ -72,6 +114,8 @@ int main(int argc, char** argv) {
     /* Initialise thread locks and plane ports array */
     sem_t lock;
     init_lock(&lock);
+    Load load = {0};
+    init_lock(&load.lock);
     int numPlanes = 0;
     char** planes = malloc(maxPlanes * sizeof(char*));
 
@@ -81,16 +125,24 @@ int main(int argc, char** argv) {
     printf("%u\n", controlPort);
     fflush(stdout);
 
-    /* If a mapper is given, register the ID and port number of this airport */
+    /* If a mapper is given, register the ID and port number of this airport,
+     * and keep renewing the registration if the mapper leases it */
     if (mapperPort) {
         if (send_info_to_mapper(mapperPort, id, controlPort) == -1) {
             fprintf(stderr, "Can not connect to map\n");
             exit(4);
         }
+        RegistrationPackage* registrationPackage =
+                malloc(sizeof(RegistrationPackage));
+        *registrationPackage = (RegistrationPackage){mapperPort, id,
+                controlPort, &load};
+        pthread_t threadID;
+        pthread_create(&threadID, 0, renew_registration, registrationPackage);
     }
 
     /* Begin accepting and handling clients */
-    PlanePackage defaultPlanePackage = {0, planes, &numPlanes, info, &lock};
+    PlanePackage defaultPlanePackage = {0, planes, &numPlanes, info, &lock,
+            &load};
     accept_clients(defaultPlanePackage, serverFileDescriptor, maxPlanes);
     return 0;
 }
@@ -142,14 +194,11 @@ in_port_t get_port_number(int fileDescriptor) {
 }
 
 /**
- * Attempts to connect to a mapper through the given port and write to it the
- * id of this control and the port number it is listening on.
+ * Attempts to connect to a mapper through the given port.
  * @param mapperPort - the port through which to connect to the mapper.
- * @param id - the id of this control.
- * @param controlPort - the port number this control is listening on.
- * @return - 0 on success, else -1 if an error occurred.
+ * @return - a stream for writing to the mapper, or NULL if an error occurred.
  */
-int send_info_to_mapper(char* mapperPort, char* id, in_port_t controlPort) {
+FILE* connect_to_mapper(char* mapperPort) {
     /* Retrieve address info */
     struct addrinfo* addressInfo = 0;
     struct addrinfo hints;
@@ -158,21 +207,164 @@ int send_info_to_mapper(char* mapperPort, char* id, in_port_t controlPort) {
     hints.ai_socktype = SOCK_STREAM;    // TCP
     if (getaddrinfo("localhost", mapperPort, &hints, &addressInfo)) {
         freeaddrinfo(addressInfo);
-        return -1;
+        return NULL;
     }
     /* Create socket */
     int mapperSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (connect(mapperSocket, addressInfo->ai_addr, sizeof(struct sockaddr))) {
+        close(mapperSocket);
+        freeaddrinfo(addressInfo);
+        return NULL;
+    }
+    freeaddrinfo(addressInfo);
+    return fdopen(mapperSocket, "w");
+}
+
+/**
+ * Attempts to connect to a mapper through the given port and write to it the
+ * id of this control and the port number it is listening on.
+ * @param mapperPort - the port through which to connect to the mapper.
+ * @param id - the id of this control.
+ * @param controlPort - the port number this control is listening on.
+ * @return - 0 on success, else -1 if an error occurred.
+ */
+int send_info_to_mapper(char* mapperPort, char* id, in_port_t controlPort) {
+    FILE* stream = connect_to_mapper(mapperPort);
+    if (!stream) {
         return -1;
     }
     /* Print information to socket */
-    FILE* stream = fdopen(mapperSocket, "w");
     fprintf(stream, "!%s:%u\n", id, controlPort);
     fclose(stream);
-    freeaddrinfo(addressInfo);
     return 0;
 }
 
+/**
+ * Attempts to connect to a mapper through the given port and ask it how long
+ * it leases registrations for.
+ * @param mapperPort - the port through which to connect to the mapper.
+ * @return - the number of seconds each registration is leased for, 0 if the
+ * mapper does not lease registrations, else -1 if an error occurred.
+ */
+int get_lease_time(char* mapperPort) {
+    FILE* writeStream = connect_to_mapper(mapperPort);
+    if (!writeStream) {
+        return -1;
+    }
+    FILE* readStream = fdopen(dup(fileno(writeStream)), "r");
+    fprintf(writeStream, "$\n");
+    fflush(writeStream);
+    char reply[MAX_CHARS + 1];
+    int leaseTime = -1;
+    if (fgets(reply, sizeof(reply), readStream) && verify_message(reply)) {
+        reply[strlen(reply) - 1] = 0; // truncate trailing '\n'
+        if (is_integer(reply)) {
+            leaseTime = atoi(reply);
+        }
+    }
+    fclose(readStream);
+    fclose(writeStream);
+    return leaseTime;
+}
+
+/**
+ * Attempts to connect to a mapper through the given port and report to it
+ * the load of this control, as registered with the given id and port number.
+ * @param mapperPort - the port through which to connect to the mapper.
+ * @param id - the id of this control.
+ * @param controlPort - the port number this control is listening on.
+ * @param load - the number of planes connected to this control.
+ * @return - 0 on success, else -1 if an error occurred.
+ */
+int send_load_to_mapper(char* mapperPort, char* id, in_port_t controlPort,
+        int load) {
+    FILE* stream = connect_to_mapper(mapperPort);
+    if (!stream) {
+        return -1;
+    }
+    fprintf(stream, "*%s:%u:%d\n", id, controlPort, load);
+    fclose(stream);
+    return 0;
+}
+
+/**
+ * Function for renewing this control's registration with a mapper, as
+ * established as a pthread. First asks the mapper how long it leases
+ * registrations for. If it leases them, re-sends the registration within
+ * half of the time the lease is sure to last for (the mapper counts leases
+ * in whole seconds, so one may expire up to a second early), so that the
+ * mapper keeps it (or restores it, if the mapper lost it). Meanwhile,
+ * checks this control's load every LOAD_INTERVAL milliseconds, and reports it
+ * whenever it has changed (and after each renewal, in case the registration
+ * was restored without it). Failures are ignored, since the mapper may only
+ * be briefly unavailable.
+ * @param var - A void pointer which may be casted to a RegistrationPackage
+ * pointer for retrieval of function arguments as specified in the
+ * documentation for RegistrationPackage.
+ * @return - NULL, though this function never returns.
+ */
+void* renew_registration(void* var) {
+    RegistrationPackage* package = (RegistrationPackage*)var;
+    int reportedLoad = 0;
+    int leaseTime = -1; // not yet known
+    long sinceRenewal = 0;
+    long sinceLoadCheck = 0;
+    while (1) {
+        if (leaseTime == -1) {
+            leaseTime = get_lease_time(package->mapperPort);
+        }
+        long renewInterval = leaseTime > 0 ? (leaseTime - 1) * 1000L / 2 : 0;
+        long interval = renewInterval && renewInterval < LOAD_INTERVAL ?
+                renewInterval : LOAD_INTERVAL;
+        struct timespec pause = {interval / 1000, interval % 1000 * 1000000};
+        nanosleep(&pause, NULL);
+        sinceRenewal += interval;
+        sinceLoadCheck += interval;
+        int renewed = renewInterval && sinceRenewal >= renewInterval;
+        if (renewed) {
+            send_info_to_mapper(package->mapperPort, package->id,
+                    package->controlPort);
+            sinceRenewal = 0;
+        }
+        if (sinceLoadCheck < LOAD_INTERVAL && !renewed) {
+            continue;
+        }
+        sinceLoadCheck = 0;
+        int load = get_load(package->load);
+        if (load != reportedLoad || (renewed && load)) {
+            if (send_load_to_mapper(package->mapperPort, package->id,
+                    package->controlPort, load) == 0) {
+                reportedLoad = load;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Reads the given load of this control.
+ * @param load - the load to read.
+ * @return - the number of planes currently connected.
+ */
+int get_load(Load* load) {
+    take_lock(&load->lock);
+    int numConnected = load->numConnected;
+    release_lock(&load->lock);
+    return numConnected;
+}
+
+/**
+ * Changes the given load of this control by the given amount, as planes
+ * connect (1) or disconnect (-1).
+ * @param load - the load to change.
+ * @param change - the amount to change the load by.
+ */
+void change_load(Load* load, int change) {
+    take_lock(&load->lock);
+    load->numConnected += change;
+    release_lock(&load->lock);
+}
+
 /**
  * Loops forever , accepting pending clients and allocating each of them a
  * pthread to another function.
@@ -184,7 +376,7 @@ int send_info_to_mapper(char* mapperPort, char* id, in_port_t controlPort) {
  */
 void accept_clients(PlanePackage defaultPackage, int serverFileDescriptor,
         size_t maxPlanes) {
-    for (int i = 0; i < maxPlanes; i++) {
+    for (size_t i = 0; i < maxPlanes; i++) {
         /* Wait for a client to connect */
         int* clientFileDescriptor = malloc(sizeof(int));
         if (*clientFileDescriptor = accept(serverFileDescriptor, 0, 0),
@@ -195,6 +387,7 @@ void accept_clients(PlanePackage defaultPackage, int serverFileDescriptor,
             planePackage->numPlanes = defaultPackage.numPlanes;
             planePackage->lock = defaultPackage.lock;
             planePackage->info = defaultPackage.info;
+            planePackage->load = defaultPackage.load;
             planePackage->fileDescriptor = *clientFileDescriptor;
             pthread_t* threadID = malloc(sizeof(threadID));
             pthread_create(threadID, 0, client_handler, planePackage);
@@ -220,6 +413,7 @@ void* client_handler(void* var) {
     int* numPlanes = planePackage.numPlanes;
     char* info = planePackage.info;
     sem_t* lock = planePackage.lock;
+    change_load(planePackage.load, 1);
     /* Create read and write streams from the given file descriptor */
     int fileDescriptorCopy = dup(fileDescriptor);
     FILE* readStream = fdopen(fileDescriptor, "r");
@@ -257,6 +451,7 @@ void* client_handler(void* var) {
     }
     fclose(readStream);
     fclose(writeStream);
+    change_load(planePackage.load, -1);
     return NULL;
 }
 
@@ -319,7 +514,7 @@ int verify_message(char* string) {
     if (string[len - 1] != '\n') {
         return 0; // text is not newline terminated
     }
-    for (int i = 0; i < len - 1; i++) {
+    for (size_t i = 0; i < len - 1; i++) {
         if (string[i] == '\n' || string[i] == '\r' || string[i] == ':') {
             return 0; // text contains invalid chars
         }
@@ -334,7 +529,7 @@ int verify_message(char* string) {
  * @return - 1 if the string contains any of the specified characters, else 0.
  */
 int contains_invalid_characters(char* string) {
-    for (int i = 0; i < strlen(string); i++) {
+    for (size_t i = 0; i < strlen(string); i++) {
         if (string[i] == '\n' || string[i] == '\r' || string[i] == ':') {
             return 1; // text contains invalid chars
         }
@@ -348,7 +543,7 @@ int contains_invalid_characters(char* string) {
  * @return - 1 if the given string is valid, else 0.
  */
 int is_integer(char* string) {
-    int i;
+    size_t i;
     for (i = 0; i < strlen(string); i++) {
         if (!isdigit(string[i])) {
             return 0;
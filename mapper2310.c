@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <netdb.h>
 #include <string.h>
@@ -5,114 +7,1046 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <ctype.h>
+#include <limits.h>
 #include <zconf.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <stddef.h>
+#include <malloc.h>
+
+typedef struct Lease Lease;
+typedef struct Waiter Waiter;
 
 /* Represents an airport, with associated name and port number for network
- * connections */
-typedef struct {
-    /* The name (or 'id') of the airport */
-    char* name;
+ * connections. An airport is a single variable-sized record, with its name
+ * stored inline after its fixed fields, so the registry holds no separate
+ * strings and no pointers to them. An ID may be registered with several port
+ * numbers (endpoints), each its own record: the first registered is the one
+ * found by ID, and the rest are chained from it in order of registration */
+typedef struct Airport {
+    /* The airport's lease, or NULL if its registration never expires */
+    Lease* lease;
+    /* The next endpoint registered with the same ID, or NULL if none */
+    _Atomic(struct Airport*) nextEndpoint;
     /* The associated port number that this airport is listening on */
-    char* portNumber;
+    uint16_t portNumber;
+    /* The number of chars allocated from its shard's arena for the record,
+     * or 0 if it was loaded in bulk (in which case its memory is never
+     * reused) */
+    uint16_t size;
+    /* The load the endpoint last reported ("*ID:PORT:LOAD"), initially 0 */
+    _Atomic uint16_t load;
+    /* The number of lookups of the ID answered so far, used to take turns
+     * between its endpoints; only kept by the first endpoint */
+    _Atomic uint16_t turn;
+    /* The name (or 'id') of the airport, null terminated */
+    char name[];
 } Airport;
 
-/* A collection of arguments for the client_handler function, to be used in
- * pthread creation for connected clients */
+/* The number of chars of an airport record holding a name of the given
+ * length (excluding its null terminator) */
+#define AIRPORT_SIZE(nameLength) (offsetof(Airport, name) + (nameLength) + 1)
+
+/* The maximum number of chars in a port number (as text) */
+#define MAX_PORT_CHARS 5
+
+/* The maximum number of endpoints an ID may be registered with */
+#define MAX_ENDPOINTS 64
+
+/* A lease on an airport's registration, which expires unless it is renewed.
+ * Leases are kept in their shard's timer wheel, and are only accessed by
+ * registrations to that shard */
+struct Lease {
+    /* The leased airport */
+    Airport* airport;
+    /* The tick of the timer wheel at which the lease expires */
+    uint64_t expiry;
+    /* The next lease in the same timer wheel slot */
+    Lease* next;
+    /* The pointer to this lease within its slot (the slot itself, or the
+     * previous lease's next), or NULL while it is not in the wheel */
+    Lease** link;
+};
+
+/* The number of levels of a timer wheel, and the number of bits of a tick
+ * which select a slot at each level */
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+/* The maximum number of ticks a lease may last for, such that its expiry is
+ * never more than half a rotation of the top level of the wheel away */
+#define MAX_LEASE_TIME ((1 << (WHEEL_LEVELS * WHEEL_BITS - 1)) - 1)
+
+/* The minimum number of ticks a lease may last for. A lease expires at the
+ * start of a tick, so one lasting a single tick may expire at once, before
+ * it could ever be renewed */
+#define MIN_LEASE_TIME 2
+
+/* A hierarchical timer wheel of leases. Level 0 holds the leases expiring
+ * within the current run of WHEEL_SLOTS ticks, one slot per tick; each level
+ * above holds leases further away, with each slot spanning a whole rotation
+ * of the level below. As ticks pass, the slots of higher levels cascade down,
+ * so scheduling, cancelling and expiring a lease each cost O(1) */
+typedef struct {
+    /* The leases in each slot of each level */
+    Lease* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    /* The current tick */
+    uint64_t now;
+} TimerWheel;
+
+/* The maximum number of airports held by a single block of the registry */
+#define BLOCK_SIZE 128
+
+/* A run of airports which are consecutive in the registry's ordering */
+typedef struct {
+    /* The airports in this block, sorted by ID */
+    Airport* airports[BLOCK_SIZE];
+    /* The number of airports in this block */
+    int numAirports;
+    /* The airports in this block as they are listed in response to "@", i.e.
+     * "ID:PORT\n" for each airport in order (not null terminated) */
+    char* listing;
+    /* The number of chars in listing */
+    size_t listingLength;
+    /* The offset within listing at which each airport's line ends. IDs are at
+     * most MAX_BATCH_CHARS long, so a full block's offsets can pass 64KiB but
+     * stay well within 32 bits */
+    uint32_t lineEnds[BLOCK_SIZE];
+    /* Set while the block belongs to an update which has not yet been
+     * published, and so may still be modified */
+    int unpublished;
+} Block;
+
+/* A version of the registry's lexicographic ordering, as a list of non-empty
+ * sorted blocks such that every airport in a block precedes every airport in
+ * the next block. Published snapshots and their blocks are never modified;
+ * registrations publish a new snapshot instead, which shares every block that
+ * the registration did not change */
+typedef struct {
+    /* The number of airports in this snapshot */
+    int numAirports;
+    /* Set once an unpublished update has changed the registry */
+    int changed;
+    /* The number of blocks in this snapshot */
+    int numBlocks;
+    /* The number of blocks this snapshot has room for */
+    int maxBlocks;
+    /* The blocks of this snapshot, in order */
+    Block* blocks[];
+} Snapshot;
+
+/* Open-addressed hash table of registered airports, in which NULL marks an
+ * empty slot and removedAirport marks a slot whose airport was removed. Slots
+ * are never emptied or moved, so readers may probe the table while a
+ * registration fills one of its slots */
+typedef struct {
+    /* The number of slots in the table; always a power of two */
+    size_t capacity;
+    /* The slots of the table */
+    _Atomic(Airport*) slots[];
+} Index;
+
+/* The airport which marks a hash index slot whose airport was removed */
+static Airport removedAirport;
+
+/* The airport which marks a port number claimed by a registration which has
+ * not yet created its airport */
+static Airport claimedPort;
+
+/* The average number of airports in each bucket of a frozen table */
+#define FROZEN_BUCKET_SIZE 4
+
+/* The number of pilots tried for a bucket of a frozen table before giving up
+ * on freezing the registry */
+#define FROZEN_MAX_TRIES (1 << 20)
+
+/* The flag marking the pilot of a bucket of a single airport, which gives
+ * the airport's slot directly (in the bits below the flag, since a table never
+ * has as many as 2^31 slots) rather than being mixed into its hash */
+#define FROZEN_DIRECT (1u << 31)
+
+/* A minimal perfect hash table over the airports of a registry which is
+ * never changed, built by hashing and displacing: the hash of each airport's
+ * ID selects a bucket, and each bucket is given a pilot, chosen so that
+ * mixing the pilot into the hash of every airport in the bucket sends each of
+ * them to a slot no other airport uses. The table has exactly one slot per
+ * airport, so a lookup costs one hash of the ID and one comparison */
+typedef struct {
+    /* The number of airports, and of slots */
+    size_t numAirports;
+    /* The number of buckets */
+    size_t numBuckets;
+    /* The pilot of each bucket */
+    uint32_t* pilots;
+    /* The airport in each slot */
+    Airport** slots;
+} FrozenTable;
+
+/* The number of bytes in each chunk of memory allocated by an arena */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* The granularity of the sizes of recyclable arena allocations */
+#define ARENA_GRANULE 8
+
+/* The largest size of a recyclable arena allocation; enough for an airport
+ * with the longest ID and port number a registration can hold */
+#define ARENA_MAX_RECYCLED 8192
+
+/* A bump allocator for memory which lives as long as the registry, such as
+ * the records of registered airports. Memory is carved out of
+ * large chunks in turn, and is never returned to the system. Recyclable
+ * allocations (see arena_allocate_recyclable) may be handed back once no
+ * longer used, and are then reused by later allocations of the same size */
+typedef struct {
+    /* The next free byte of the current chunk */
+    char* next;
+    /* The number of free bytes left in the current chunk */
+    size_t remaining;
+    /* The recycled allocations of each size, in multiples of ARENA_GRANULE,
+     * linked through their first bytes */
+    void* freeLists[ARENA_MAX_RECYCLED / ARENA_GRANULE + 1];
+} Arena;
+
+/* The maximum number of threads which may read the registry */
+#define MAX_READERS 256
+
+/* Announces the epoch in which a reader thread began reading the registry,
+ * or 0 while it is not reading. Padded to a cache line so that readers do not
+ * contend with each other */
 typedef struct {
-    /* The client's file descriptor from which to open read and write
-     * streams */
+    _Atomic uint64_t epoch;
+    char padding[64 - sizeof(uint64_t)];
+} ReaderSlot;
+
+/* Memory which has been unlinked from the registry, but which readers that
+ * entered the registry before it was unlinked may still be using */
+typedef struct Retired {
+    /* The memory to free */
+    void* memory;
+    /* The size of the memory if it is to be recycled into its shard's arena,
+     * else 0 if it is to be freed */
+    size_t recycledSize;
+    /* The epoch in which the memory was unlinked */
+    uint64_t epoch;
+    /* The next retired memory in the list */
+    struct Retired* next;
+} Retired;
+
+/* The maximum number of shards the registry may be partitioned into */
+#define MAX_SHARDS 256
+
+/* The number of shards the registry is partitioned into by default */
+#define DEFAULT_SHARDS 16
+
+typedef struct Registry Registry;
+typedef struct SharedTable SharedTable;
+
+/* A growable array of chars, used to queue output for a client */
+typedef struct {
+    /* The chars held by the buffer (not null terminated) */
+    char* data;
+    /* The number of chars held by the buffer */
+    size_t length;
+    /* The number of chars the buffer can hold before it must grow */
+    size_t capacity;
+} Buffer;
+
+/* The maximum number of chars of events queued for a subscriber, beyond
+ * which the subscriber is dropped rather than holding up registrations */
+#define SUBSCRIPTION_QUEUE_CHARS (256 * 1024)
+
+/* A client's subscription to changes of the registry. Registrations append
+ * events to its queue, which its reactor moves into the client's output */
+typedef struct Subscription {
+    /* The lock taken to access queue and dropped */
+    sem_t lock;
+    /* Events not yet taken by the reactor, one "+ID:PORT" or "-ID:PORT" per
+     * line */
+    Buffer queue;
+    /* Set once the queue has overflowed, after which no more events are
+     * queued and the subscriber must be disconnected */
+    int dropped;
+    /* The eventfd of the reactor which owns the subscriber, written to when
+     * events are queued */
+    int wakeFileDescriptor;
+    /* The next subscription in the registry's list */
+    struct Subscription* next;
+} Subscription;
+
+/* One partition of the registry, holding the airports whose IDs hash to it,
+ * both in lexicographic order of ID and in a hash index keyed by ID. Readers
+ * reach the shard's current snapshot and index through atomically swapped
+ * pointers. Registrations to the shard are serialised by its lock */
+typedef struct {
+    /* The current snapshot of the shard's ordering */
+    _Atomic(Snapshot*) snapshot;
+    /* The current hash index of the shard */
+    _Atomic(Index*) index;
+    /* The number of filled slots in the hash index */
+    int numIndexed;
+    /* The number of those slots which hold removedAirport */
+    int numRemoved;
+    /* The lock taken by registrations, to prevent simultaneous changes to
+     * the shard */
+    sem_t lock;
+    /* Memory waiting to be freed, most recently retired first */
+    Retired* retired;
+    /* The arena which the shard's airports are allocated from */
+    Arena arena;
+    /* The leases on the shard's airports */
+    TimerWheel wheel;
+    /* The events of the update in progress, to be queued for every
+     * subscription once it is published */
+    Buffer events;
+    /* The lookups waiting for an ID of this shard to be registered */
+    Waiter* waiters;
+    /* The registry this shard belongs to */
+    Registry* registry;
+} Shard;
+
+/* The airports registered with the mapper, partitioned into shards by a hash
+ * of their IDs so that registrations to different shards never contend.
+ * Readers never block: they announce the epoch in which they entered the
+ * registry, and each shard frees replaced memory once every reader has moved
+ * past the epoch it was replaced in */
+struct Registry {
+    /* The shards of the registry */
+    Shard* shards;
+    /* The number of shards */
+    int numShards;
+    /* The current epoch; advanced whenever memory is retired */
+    _Atomic uint64_t epoch;
+    /* The epoch announcements of each reader thread */
+    ReaderSlot readers[MAX_READERS];
+    /* The number of reader slots handed out */
+    _Atomic int numReaders;
+    /* The number of updates published to any shard, used to tell whether
+     * the snapshot file is out of date */
+    _Atomic uint64_t numChanges;
+    /* The number of ticks (seconds) each registration's lease lasts for, or
+     * 0 if registrations never expire */
+    int leaseTime;
+    /* The subscriptions to changes of the registry. Subscribing takes every
+     * shard's lock, so an update never sees the list gain a subscription */
+    Subscription* subscriptions;
+    /* The number of subscriptions; events are only recorded while it is
+     * not 0 */
+    _Atomic int numSubscriptions;
+    /* The lock taken to access subscriptions, after any shard's lock */
+    sem_t subscriptionsLock;
+    /* The shared memory copy of the registry kept up to date for local
+     * clients, or NULL if there is none */
+    SharedTable* sharedTable;
+    /* The perfect hash table airports are looked up in once the registry is
+     * frozen, after which it is never changed; NULL until then */
+    FrozenTable* frozenTable;
+    /* The airport registered with each port number (indexed by port number),
+     * or NULL if there is none, so that no two airports share a port number
+     * and airports can be looked up by port number. An entry is claimed
+     * (from NULL) by the registration to any shard which first adds an
+     * airport with its port number, and cleared by the removal of that
+     * airport */
+    _Atomic(Airport*)* ports;
+};
+
+/* A position within one shard's snapshot, used to merge the shards' orderings
+ * when listing the registry. Positions are given as a block index and a
+ * position within that block, where the position after the last airport is
+ * block numBlocks, position 0 */
+typedef struct {
+    /* The snapshot being listed */
+    Snapshot* snapshot;
+    /* The index of the current block within the snapshot */
+    int blockIndex;
+    /* The position of the current airport within the block */
+    int position;
+    /* The index of the block holding the position to stop listing at */
+    int endBlock;
+    /* The position within endBlock to stop listing at */
+    int endPosition;
+} Cursor;
+
+/* How many airports ahead to prefetch hash index slots when filling an empty
+ * registry */
+#define INDEX_PREFETCH_DISTANCE 16
+
+/* The identifying bytes at the start of a snapshot file */
+#define SNAPSHOT_MAGIC "MAP2310\1"
+
+/* The number of seconds between checks for whether the snapshot file must be
+ * rewritten */
+#define SNAPSHOT_INTERVAL 1
+
+/* The header of a snapshot file: a binary image of the registry which can be
+ * mapped into memory and served from without parsing. The header is followed
+ * by numAirports records, sorted by ID, each of which is the null terminated
+ * ID followed by the null terminated port number */
+typedef struct {
+    /* Always SNAPSHOT_MAGIC */
+    char magic[8];
+    /* The number of airports recorded in the file */
+    uint64_t numAirports;
+    /* The number of chars of records which follow the header */
+    uint64_t recordsLength;
+} SnapshotHeader;
+
+/* The identifying bytes at the start of a shared memory segment */
+#define SHARED_MAGIC "MAPSHM2"
+
+/* The name of the shared memory segment of the mapper listening on a port,
+ * given that port number */
+#define SHARED_NAME_FORMAT "/mapper2310-%u"
+
+/* The name offset which marks a shared slot whose airport was removed */
+#define SHARED_REMOVED UINT32_MAX
+
+/* The smallest number of slots, and of chars of strings, a shared memory
+ * segment is created with */
+#define SHARED_MIN_SLOTS 1024
+#define SHARED_MIN_STRINGS (64 * 1024)
+
+/* The header of a shared memory segment: a read-only copy of the registry
+ * which clients on the same host look IDs up in without a round trip to the
+ * mapper. The header is followed by an open-addressed hash table of capacity
+ * slots (see SharedSlot), then by stringsCapacity chars of null terminated
+ * IDs and port numbers. The segment is guarded by a seqlock: sequence is odd
+ * while the mapper changes the segment, so a reader copies what it needs,
+ * then retries if sequence was odd or has since changed */
+typedef struct {
+    /* Always SHARED_MAGIC */
+    char magic[8];
+    /* The seqlock's sequence number; odd while the segment is changing */
+    _Atomic uint64_t sequence;
+    /* The process id of the mapper, and the time its process started (in
+     * clock ticks since the host booted, as given by /proc), so clients can
+     * ignore the segment of a mapper which died, even once another process
+     * has been given its process id */
+    uint64_t processID;
+    uint64_t startTime;
+    /* The number of slots in the hash table; always a power of two */
+    uint64_t capacity;
+    /* The number of chars of room for strings */
+    uint64_t stringsCapacity;
+    /* The number of chars of strings in use; strings are only appended, and
+     * the first char is unused so that offset 0 marks an empty slot */
+    uint64_t stringsLength;
+    /* The number of slots which are not empty, including removed ones */
+    uint64_t numFilled;
+    /* The number of slots which hold an airport */
+    uint64_t numAirports;
+} SharedHeader;
+
+/* A slot of a shared memory segment's hash table, keyed by hash_id */
+typedef struct {
+    /* The hash of the airport's ID */
+    uint64_t hash;
+    /* The offset of the airport's ID among the strings; 0 if the slot is
+     * empty, or SHARED_REMOVED if its airport was removed */
+    uint32_t name;
+    /* The offset of the airport's port number among the strings */
+    uint32_t portNumber;
+} SharedSlot;
+
+/* The mapper's side of its shared memory segment. Updates from every shard
+ * are applied in turn, under the lock */
+struct SharedTable {
+    /* The segment's file descriptor */
     int fileDescriptor;
-    /* The lock shared amongst pthreads to prevent simultaneous interactions
-     * with the same memory */
-    sem_t* lock;
-    /* The array airports registered with the mapper */
-    Airport** airports;
-    /* The size of the array of airports registered with the mapper */
-    int* numAirports;
-} ClientPackage;
-
-void* client_handler(void* vars);
-void init_lock(sem_t* lock);
-void take_lock(sem_t* lock);
-void release_lock(sem_t* lock);
-int get_airport_index(char* airportName, Airport** airports, int numAirports);
-void add_airport(char command[], Airport** airports, int* numAirports);
-int is_integer(char* string);
-int listen_on_ephemeral_port();
-void handle_input(char* message, FILE* stream, Airport** airports,
-        int* numAirports);
-in_port_t get_port_number(int fileDescriptor);
+    /* The segment, mapped for reading and writing */
+    SharedHeader* header;
+    /* The number of bytes mapped */
+    size_t size;
+    /* The lock taken to change the segment */
+    sem_t lock;
+    /* The segment's name */
+    char name[32];
+};
+
+/* The shared table whose segment is removed when the mapper exits, if any */
+static SharedTable* exitingTable;
+
+typedef struct Journal Journal;
+
+/* A collection of arguments for the write_snapshot_files function, to be used
+ * in pthread creation */
+typedef struct {
+    /* The path of the snapshot file to keep up to date */
+    char* path;
+    /* The airports registered with the mapper */
+    Registry* registry;
+    /* The number of changes to the registry already saved to the file */
+    uint64_t numSaved;
+    /* The journal to compact after each save, or NULL if none */
+    Journal* journal;
+} SnapshotWriter;
 
 /* The maximum permitted size of messages sent and received via network
  * communications */
 #define MAX_CHARS 79
 
-int main(int argc, char** argv) {
-    if (argc != 1) {
-        return 1;
-    }
+/* The maximum permitted size of a batched lookup ("&") or registration ("!")
+ * message, which may exceed the size of other messages */
+#define MAX_BATCH_CHARS 4095
+
+/* The number of chars a waiting lookup ("?ID:TIMEOUT") may add after its ID,
+ * so that it can wait for any ID a batched lookup can ask for */
+#define WAIT_CHARS 8
+
+/* The number of chars of input buffered per client; room for the longest
+ * permitted message plus its newline, and then as much again so that many
+ * short messages can be received per recv call */
+#define INPUT_CHARS (2 * (MAX_BATCH_CHARS + WAIT_CHARS + 1))
+
+/* The maximum number of events handled per epoll_wait call */
+#define MAX_EVENTS 64
 
-    // the maximum number of airports this mapper can register
-    size_t maxAirports = 1000;
+/* The maximum number of lookup datagrams received (and answered) per
+ * recvmmsg call */
+#define MAX_DATAGRAMS 64
 
-    /* Initialise the lock that will be used to ensure pthread safety */
+/* The maximum number of chars of a reply datagram */
+#define MAX_DATAGRAM_CHARS 65507
+
+/* The number of pending connections each listening socket queues by default */
+#define DEFAULT_BACKLOG 10
+
+/* The amount of unsent output above which a client's input stops being read
+ * until that output has drained */
+#define MAX_PENDING_OUTPUT (64 * 1024)
+
+/* An append-only journal of registrations and deregistrations, which makes
+ * each of them durable before it is applied to the registry. Reactors append
+ * them to a pending batch; a committer thread writes and syncs the whole
+ * batch at once (a group commit), applies it, then wakes every reactor so
+ * connections waiting on the batch can continue */
+struct Journal {
+    /* The path of the journal file */
+    char* path;
+    /* The journal file, open for appending */
+    int fileDescriptor;
+    /* The number of chars written to the journal file */
+    off_t length;
+    /* The lock held while the journal file is written to or replaced */
+    sem_t fileLock;
+    /* The lock taken to append to pending */
     sem_t lock;
-    init_lock(&lock);
+    /* Posted when registrations are appended to an empty pending batch */
+    sem_t ready;
+    /* Messages waiting to be committed, one "!ID:PORT..." or "-ID[:PORT]"
+     * per line */
+    Buffer pending;
+    /* The number of registrations ever appended to the journal */
+    uint64_t numAppended;
+    /* The number of registrations which are durable and have been applied */
+    _Atomic uint64_t numCommitted;
+    /* The eventfd of each reactor, written to after each commit */
+    int* wakeFileDescriptors;
+    /* The number of reactors */
+    int numReactors;
+    /* The airports registered with the mapper */
+    Registry* registry;
+};
 
-    /* Initialise the array of airports this mapper will store */
-    Airport** airports = malloc(maxAirports * sizeof(Airport*));
-    int numAirports = 0;
+/* Represents a client connection owned by a reactor, along with any input
+ * received from it which does not yet form a full line and any output which
+ * could not yet be written to it */
+typedef struct Connection {
+    /* The client's non-blocking socket file descriptor */
+    int fileDescriptor;
+    /* Input received from the client but not yet processed, which always
+     * begins at the start of a line. Lines are parsed in place, and only the
+     * trailing partial line is kept between receives */
+    char input[INPUT_CHARS];
+    /* The number of chars held in input */
+    size_t inputLength;
+    /* Set while the remainder of an over-long line is being discarded */
+    int discarding;
+    /* Output waiting for the client's socket to become writable */
+    Buffer output;
+    /* The events the reactor's epoll instance is watching for */
+    uint32_t watchedEvents;
+    /* Set once the client has closed its end of the connection */
+    int closing;
+    /* Set once a socket error has occurred and the connection must drop */
+    int failed;
+    /* Set while the connection waits for a journalled registration to be
+     * committed; its remaining input is held until then */
+    int parked;
+    /* The number of registrations which must be committed to unpark it */
+    uint64_t awaitedCommit;
+    /* The next connection in its reactor's list of parked connections */
+    struct Connection* nextParked;
+    /* The client's subscription to changes of the registry, or NULL if it
+     * has not subscribed */
+    Subscription* subscription;
+    /* The next connection in its reactor's list of subscribed connections */
+    struct Connection* nextSubscriber;
+    /* The lookup the connection is parked on until its ID is registered,
+     * or NULL if there is none */
+    Waiter* waiter;
+} Connection;
+
+/* A collection of arguments for the run_reactor function, to be used in
+ * pthread creation for each event loop */
+typedef struct {
+    /* The non-blocking socket on which the reactor accepts clients; either
+     * shared by every reactor, or the reactor's own in SO_REUSEPORT mode */
+    int listenFileDescriptor;
+    /* The epoll instance owned by this reactor (set by run_reactor) */
+    int epollFileDescriptor;
+    /* The airports registered with the mapper */
+    Registry* registry;
+    /* The reader slot this reactor announces its registry reads in */
+    int reader;
+    /* The journal registrations are made durable in, or NULL if none */
+    Journal* journal;
+    /* The eventfd the journal wakes this reactor through after a commit,
+     * and subscriptions wake it through once events are queued */
+    int wakeFileDescriptor;
+    /* The reactor's connections which are waiting on the journal */
+    Connection* parked;
+    /* The reactor's connections which have subscribed */
+    Connection* subscribers;
+    /* The non-blocking UDP socket on which the reactor answers lookups;
+     * shared or its own, as for listenFileDescriptor, or -1 if none */
+    int datagramFileDescriptor;
+    /* The reactor's waiting lookups, in order of deadline */
+    Waiter* firstDeadline;
+    Waiter* lastDeadline;
+    /* The reactor's waiting lookups whose IDs have been registered, pushed
+     * by whichever thread registered them */
+    _Atomic(Waiter*) woken;
+} Reactor;
+
+/* The maximum number of milliseconds a lookup may wait for its ID to be
+ * registered */
+#define MAX_WAIT_TIME 9999999
+
+/* A lookup ("?ID:TIMEOUT") whose connection is parked until its ID is
+ * registered, or its deadline passes. Until then it is listed by the shard
+ * the ID hashes to, where registering the ID finds it and pushes it onto its
+ * reactor's woken stack; it is also listed by its reactor in order of
+ * deadline, so the reactor can time it out */
+struct Waiter {
+    /* The parked connection */
+    Connection* connection;
+    /* The reactor which owns the connection */
+    Reactor* reactor;
+    /* The time (see get_milliseconds) after which the lookup fails */
+    uint64_t deadline;
+    /* The hash of the awaited ID */
+    uint64_t hash;
+    /* The port number the ID was registered with, once it has been */
+    uint16_t portNumber;
+    /* The next waiter in the shard's list */
+    Waiter* next;
+    /* The pointer to this waiter within the shard's list (the list itself,
+     * or the previous waiter's next), or NULL once it has left the list */
+    Waiter** link;
+    /* The neighbouring waiters in the reactor's list, by deadline */
+    Waiter* nextDeadline;
+    Waiter* previousDeadline;
+    /* The next waiter in the reactor's woken stack */
+    Waiter* nextWoken;
+    /* The awaited ID */
+    char airportName[];
+};
+
+/* The buffers a reactor receives a batch of lookup datagrams into, and
+ * answers them from, with one recvmmsg and one sendmmsg call */
+typedef struct {
+    /* The received datagrams, as passed to recvmmsg */
+    struct mmsghdr messages[MAX_DATAGRAMS];
+    /* The vector pointing at each datagram's input */
+    struct iovec vectors[MAX_DATAGRAMS];
+    /* The address each datagram was sent from, and its reply is sent to */
+    struct sockaddr_in addresses[MAX_DATAGRAMS];
+    /* The contents of each datagram, with room to null terminate the
+     * longest permitted message and its newline */
+    char inputs[MAX_DATAGRAMS][MAX_BATCH_CHARS + 2];
+    /* The reply to each datagram */
+    Buffer outputs[MAX_DATAGRAMS];
+    /* The replies, as passed to sendmmsg */
+    struct mmsghdr replies[MAX_DATAGRAMS];
+    /* The vector pointing at each reply's output */
+    struct iovec replyVectors[MAX_DATAGRAMS];
+} DatagramBatch;
+
+void* run_reactor(void* vars);
+void accept_clients(Reactor* reactor);
+void answer_datagrams(Reactor* reactor, DatagramBatch* batch);
+void receive_input(Reactor* reactor, Connection* connection);
+void frame_lines(Reactor* reactor, Connection* connection);
+size_t max_message_chars(char* message);
+void process_line(Reactor* reactor, Connection* connection, char* message);
+void flush_output(Reactor* reactor, Connection* connection);
+void close_connection(Reactor* reactor, Connection* connection);
+void close_if_finished(Reactor* reactor, Connection* connection);
+void wake_reactor(Reactor* reactor);
+void resume_connections(Reactor* reactor);
+void subscribe(Reactor* reactor, Connection* connection);
+void unsubscribe(Reactor* reactor, Connection* connection);
+void deliver_events(Reactor* reactor, Connection* connection);
+void wait_for_airport(Reactor* reactor, Connection* connection,
+        char* airportName, int timeout);
+void wake_waiters(Airport* airport, Shard* shard);
+void resume_waiters(Reactor* reactor);
+void expire_waiters(Reactor* reactor);
+void cancel_wait(Reactor* reactor, Connection* connection);
+void finish_wait(Reactor* reactor, Waiter* waiter, uint16_t portNumber);
+void remove_deadline(Reactor* reactor, Waiter* waiter);
+void unlink_waiter(Waiter* waiter);
+int get_wait_timeout(Reactor* reactor);
+uint64_t get_milliseconds(void);
+void append_output(Buffer* buffer, const char* text, size_t length);
+void init_lock(sem_t* lock);
+void take_lock(sem_t* lock);
+void release_lock(sem_t* lock);
+void init_registry(Registry* registry, int numShards);
+int register_reader(Registry* registry);
+void enter_registry(Registry* registry, int reader);
+void leave_registry(Registry* registry, int reader);
+void retire(Shard* shard, void* memory, size_t recycledSize);
+void reclaim(Shard* shard);
+uint64_t hash_id(const char* airportName);
+Shard* find_shard(uint64_t hash, Registry* registry);
+Airport* get_airport(char* airportName, Registry* registry);
+Airport* choose_endpoint(Airport* airport);
+Airport* get_airport_by_port(uint16_t portNumber, Registry* registry);
+int freeze_registry(FrozenTable* table, Registry* registry);
+size_t find_frozen_bucket(uint64_t hash, size_t numBuckets);
+size_t find_frozen_slot(uint64_t hash, uint32_t pilot, size_t numSlots);
+uint64_t mix_hash(uint64_t hash);
+size_t reduce_hash(uint64_t hash, size_t range);
+void index_airport(Airport* airport, Shard* shard);
+void unindex_airport(Airport* airport, Shard* shard);
+void grow_index(Shard* shard);
+void register_airports(char command[], Registry* registry);
+int renew_airports(char command[], Registry* registry);
+void add_airport(char* airportName, char* portNumber, Snapshot** update,
+        Shard* shard);
+int check_registration(char* airportName, uint16_t port, Shard* shard,
+        Airport** last);
+void record_event(char sign, Airport* airport, Shard* shard);
+void deregister_airport(char* command, Registry* registry);
+void report_load(char* command, Registry* registry);
+void remove_airport(Airport* airport, Snapshot** update, Shard* shard);
+void apply_registration(char* message, Registry* registry);
+void lease_airport(Airport* airport, Shard* shard);
+void schedule_lease(TimerWheel* wheel, Lease* lease);
+void cancel_lease(Lease* lease);
+Lease* advance_wheel(TimerWheel* wheel);
+void* expire_leases(void* vars);
+int load_airports(FILE* file, Registry* registry);
+int build_registry(Airport** sorted, size_t numSorted, Registry* registry);
+int map_snapshot_file(int fileDescriptor, Registry* registry);
+void* write_snapshot_files(void* vars);
+int save_snapshot_file(char* path, Registry* registry, int reader);
+int sync_directory(char* path);
+int open_journal(Journal* journal, char* path, Registry* registry);
+uint64_t append_to_journal(Journal* journal, char* registrations);
+void* commit_registrations(void* vars);
+int compact_journal(Journal* journal, off_t covered);
+int create_shared_table(SharedTable* table, in_port_t portNumber,
+        Registry* registry);
+void remove_shared_table(void);
+void* await_termination(void* vars);
+uint64_t get_start_time(pid_t processID);
+void share_events(SharedTable* table, Buffer* events, Registry* registry);
+void share_airport(SharedTable* table, char* airportName, char* portNumber);
+void unshare_airport(SharedTable* table, char* airportName);
+SharedSlot* find_shared_slot(SharedHeader* header, char* airportName,
+        uint64_t hash);
+int resize_shared_table(SharedTable* table, size_t numSlots,
+        size_t numChars);
+int compare_airports(const void* first, const void* second);
+int find_block(char* airportName, Snapshot* snapshot);
+int find_position(char* airportName, Block* block);
+Snapshot* begin_update(Shard* shard);
+void insert_airport(Airport* airport, Snapshot** update, Shard* shard);
+Block* modify_block(Snapshot* snapshot, int blockIndex, Shard* shard);
+void publish_update(Snapshot* update, Shard* shard);
+void queue_events(Shard* shard);
+void serialise_block(Block* block);
+size_t list_airports(Buffer* output, Registry* registry, char* from, char* to,
+        size_t limit, char** last);
+size_t list_snapshots(Buffer* output, Snapshot** snapshots, int numSnapshots,
+        char* from, char* to, size_t limit, char** last);
+void find_first(char* airportName, Snapshot* snapshot, int* blockIndex,
+        int* position);
+char* cursor_name(Cursor* cursor);
+void sift_down(Cursor* heap, int heapSize, int parent);
+void* arena_allocate(Arena* arena, size_t size, size_t alignment);
+void* arena_allocate_recyclable(Arena* arena, size_t size);
+void arena_recycle(Arena* arena, void* memory, size_t size);
+int is_integer(char* string);
+uint16_t parse_port_number(char* portNumber);
+size_t format_port_number(uint16_t portNumber, char* output);
+size_t pool_airport(Buffer* pool, const char* airportName, size_t nameLength,
+        uint16_t portNumber);
+int listen_on_port(in_port_t portNumber, int backlog, int reusePort);
+int bind_to_port(in_port_t portNumber, int type, int reusePort);
+void handle_input(char* message, Buffer* output, Registry* registry);
+void send_port_numbers(char* airportNames, Buffer* output, Registry* registry);
+void send_page(char* request, Buffer* output, Registry* registry);
+in_port_t get_port_number(int fileDescriptor);
+
+int main(int argc, char** argv) {
+    /* Verify args */
+    char* registrationsFile = NULL;
+    int numShards = DEFAULT_SHARDS;
+    int backlog = DEFAULT_BACKLOG;
+    int reusePort = 0;
+    char* snapshotFile = NULL;
+    char* journalFile = NULL;
+    int leaseTime = 0;
+    int answerDatagrams = 0;
+    int shareRegistry = 0;
+    int freeze = 0;
+    int option;
+    while ((option = getopt(argc, argv, "l:s:b:rf:j:t:ump")) != -1) {
+        if (option == 'l') {
+            registrationsFile = optarg;
+        } else if (option == 'f') {
+            snapshotFile = optarg;
+        } else if (option == 'j') {
+            journalFile = optarg;
+        } else if (option == 's' && is_integer(optarg) && atoi(optarg) >= 1 &&
+                atoi(optarg) <= MAX_SHARDS) {
+            numShards = atoi(optarg);
+        } else if (option == 'b' && is_integer(optarg) && atoi(optarg) >= 1) {
+            backlog = atoi(optarg);
+        } else if (option == 'r') {
+            reusePort = 1;
+        } else if (option == 't' && is_integer(optarg) &&
+                strlen(optarg) <= 7 && atoi(optarg) >= MIN_LEASE_TIME &&
+                atoi(optarg) <= MAX_LEASE_TIME) {
+            leaseTime = atoi(optarg);
+        } else if (option == 'u') {
+            answerDatagrams = 1;
+        } else if (option == 'm') {
+            shareRegistry = 1;
+        } else if (option == 'p') {
+            freeze = 1;
+        } else {
+            optind = 0; // flag invalid usage
+            break;
+        }
+    }
+    if (optind != argc || (freeze && (journalFile || leaseTime ||
+            (!registrationsFile && !snapshotFile)))) {
+        fprintf(stderr, "Usage: mapper2310 [-l registrations] [-s shards] "
+                "[-b backlog] [-r] [-f snapshot] [-j journal] [-t ttl] [-u] "
+                "[-m] [-p]\n");
+        exit(1);
+    }
+
+    /* Initialise the registry of airports this mapper will store, restoring
+     * it from the snapshot file if there is one, else preloading the given
+     * registrations file if there is one, then replaying the journal. With a
+     * lease time, every airport registered here gets a fresh lease */
+    static Registry registry;
+    init_registry(&registry, numShards);
+    registry.leaseTime = leaseTime;
+    static Journal journal;
+    static SnapshotWriter snapshotWriter;
+    snapshotWriter = (SnapshotWriter){snapshotFile, &registry, UINT64_MAX,
+            journalFile ? &journal : NULL};
+    int snapshotDescriptor = snapshotFile ? open(snapshotFile, O_RDONLY) : -1;
+    if (snapshotDescriptor != -1) {
+        if (map_snapshot_file(snapshotDescriptor, &registry) == -1) {
+            fprintf(stderr, "Invalid snapshot file\n");
+            exit(2);
+        }
+        close(snapshotDescriptor);
+        snapshotWriter.numSaved = 0; // the file is already up to date
+    } else if (registrationsFile) {
+        FILE* file = fopen(registrationsFile, "r");
+        if (!file) {
+            fprintf(stderr, "Invalid registrations file\n");
+            exit(2);
+        }
+        load_airports(file, &registry);
+        fclose(file);
+    }
+    if (journalFile && open_journal(&journal, journalFile, &registry) == -1) {
+        fprintf(stderr, "Invalid journal file\n");
+        exit(2);
+    }
+    static FrozenTable frozenTable;
+    if (freeze && freeze_registry(&frozenTable, &registry) == -1) {
+        fprintf(stderr, "Unable to freeze registry\n");
+        exit(6);
+    }
 
-    /* Begin listening on an ephemeral port, and print that port to stdout */
-    int socketFileDescriptor = listen_on_ephemeral_port();
+    /* Begin listening on an ephemeral port, and print that port to stdout.
+     * In SO_REUSEPORT mode every reactor gets its own listening socket on
+     * that port, so the kernel spreads new clients across their backlogs;
+     * otherwise the reactors share the one socket. Lookup datagrams are
+     * answered on the UDP port of the same number, which is shared or not
+     * in the same way */
+    long numReactors = sysconf(_SC_NPROCESSORS_ONLN);
+    Reactor* reactors = calloc(numReactors, sizeof(Reactor));
+    int socketFileDescriptor = listen_on_port(0, backlog, reusePort);
+    if (socketFileDescriptor == -1) {
+        fprintf(stderr, "Unable to listen\n");
+        exit(3);
+    }
     in_port_t portNumber = get_port_number(socketFileDescriptor);
+    int datagramFileDescriptor = -1;
+    for (long i = 0; i < numReactors; i++) {
+        if (reusePort && i) {
+            socketFileDescriptor = listen_on_port(portNumber, backlog, 1);
+            if (socketFileDescriptor == -1) {
+                fprintf(stderr, "Unable to listen\n");
+                exit(3);
+            }
+        }
+        fcntl(socketFileDescriptor, F_SETFL,
+                fcntl(socketFileDescriptor, F_GETFL) | O_NONBLOCK);
+        if (answerDatagrams && (reusePort || !i)) {
+            datagramFileDescriptor = bind_to_port(portNumber, SOCK_DGRAM,
+                    reusePort);
+            if (datagramFileDescriptor == -1) {
+                fprintf(stderr, "Unable to listen\n");
+                exit(3);
+            }
+            fcntl(datagramFileDescriptor, F_SETFL,
+                    fcntl(datagramFileDescriptor, F_GETFL) | O_NONBLOCK);
+        }
+        reactors[i] = (Reactor){socketFileDescriptor, -1, &registry, -1,
+                NULL, eventfd(0, EFD_NONBLOCK), NULL, NULL,
+                datagramFileDescriptor, NULL, NULL, NULL};
+    }
+
+    /* Publish the registry in shared memory for clients on this host to
+     * read directly, before anything can change it */
+    static SharedTable sharedTable;
+    if (shareRegistry) {
+        if (create_shared_table(&sharedTable, portNumber, &registry) == -1) {
+            fprintf(stderr, "Unable to share registry\n");
+            exit(5);
+        }
+        registry.sharedTable = &sharedTable;
+        /* Remove the segment once the mapper exits, or is terminated or
+         * interrupted: those signals are blocked in every thread (which
+         * inherit this one's mask) but one, which waits for them */
+        exitingTable = &sharedTable;
+        atexit(remove_shared_table);
+        static sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        pthread_t threadID;
+        pthread_create(&threadID, 0, await_termination, &signals);
+    }
     printf("%u\n", portNumber);
     fflush(stdout);
 
-    /* Continuously accept and handle callers */
-    for (int i = 0; i < maxAirports; i++) {
-        int* fileDescriptor = malloc(sizeof(int));
-        ClientPackage* clientPackage = malloc(sizeof(ClientPackage));
-        if (*fileDescriptor = accept(socketFileDescriptor, 0, 0),
-                *fileDescriptor >= 0) {
-            clientPackage->fileDescriptor = *fileDescriptor;
-            clientPackage->airports = airports;
-            clientPackage->numAirports = &numAirports;
-            clientPackage->lock = &lock;
-            pthread_t* threadID = malloc(sizeof(threadID));
-            pthread_create(threadID, 0, client_handler, clientPackage);
+    /* Commit journalled registrations in the background, waking each reactor
+     * through its own eventfd after every commit */
+    if (journalFile) {
+        journal.numReactors = numReactors;
+        journal.wakeFileDescriptors = malloc(numReactors * sizeof(int));
+        for (long i = 0; i < numReactors; i++) {
+            reactors[i].journal = &journal;
+            journal.wakeFileDescriptors[i] = reactors[i].wakeFileDescriptor;
         }
+        pthread_t threadID;
+        pthread_create(&threadID, 0, commit_registrations, &journal);
+    }
+
+    /* Expire leased registrations in the background */
+    if (leaseTime) {
+        pthread_t threadID;
+        pthread_create(&threadID, 0, expire_leases, &registry);
+    }
+
+    /* Keep the snapshot file up to date in the background */
+    if (snapshotFile) {
+        pthread_t threadID;
+        pthread_create(&threadID, 0, write_snapshot_files, &snapshotWriter);
+    }
+
+    /* Continuously accept and handle callers, using one event loop per
+     * online core; the main thread runs the last of them */
+    for (long i = 1; i < numReactors; i++) {
+        pthread_t threadID;
+        pthread_create(&threadID, 0, run_reactor, &reactors[i]);
+    }
+    run_reactor(&reactors[0]);
+    return 0;
+}
+
+/**
+ * Finds the address of the given port (or of any available ephemeral port if
+ * the given port is 0), binds a socket to it, begins listening on the
+ * socket's file descriptor, and returns the socket's file descriptor if
+ * successful.
+ * @param portNumber - the port to listen on, or 0 for an ephemeral port.
+ * @param backlog - the maximum number of pending connections to queue.
+ * @param reusePort - whether to set SO_REUSEPORT, allowing further sockets
+ * to listen on the same port.
+ * @return the file descriptor of the bound socket, or -1 if an error occurred.
+ */
+int listen_on_port(in_port_t portNumber, int backlog, int reusePort) {
+    int fileDescriptor = bind_to_port(portNumber, SOCK_STREAM, reusePort);
+    if (fileDescriptor == -1) {
+        return -1;
+    }
+    /* Binding succeeded; begin listening on the port */
+    if (listen(fileDescriptor, backlog)) {
+        close(fileDescriptor);
+        return -1;
     }
+    return fileDescriptor;
 }
 
 /**
- * Finds the address of any available ephemeral port, binds a socket to it,
- * begins listening on the socket's file descriptor, and returns the socket's
- * file descriptor if successful.
+ * Finds the address of the given port (or of any available ephemeral port if
+ * the given port is 0), creates a socket of the given type and binds it to
+ * that address.
+ * @param portNumber - the port to bind to, or 0 for an ephemeral port.
+ * @param type - the type of socket; SOCK_STREAM (TCP) or SOCK_DGRAM (UDP).
+ * @param reusePort - whether to set SO_REUSEPORT, allowing further sockets
+ * to bind to the same port.
  * @return the file descriptor of the bound socket, or -1 if an error occurred.
  */
-int listen_on_ephemeral_port() {
-    /* Retrieve the address of any available ephemeral port */
+int bind_to_port(in_port_t portNumber, int type, int reusePort) {
+    /* Retrieve the address of the port */
     struct addrinfo* addressInfo = 0;
     struct addrinfo hints;
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_INET;          // IPv4
-    hints.ai_socktype = SOCK_STREAM;    // TCP
+    hints.ai_socktype = type;
     hints.ai_flags = AI_PASSIVE;
     if (getaddrinfo("localhost", 0, &hints, &addressInfo)) {
         freeaddrinfo(addressInfo);
         return -1;
     }
+    ((struct sockaddr_in*)addressInfo->ai_addr)->sin_port = htons(portNumber);
     /* Create a socket and bind it to the address we just retrieved */
-    int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
-    if (bind(fileDescriptor, addressInfo->ai_addr, sizeof(struct sockaddr))) {
-        return -1;
-    }
-    /* Binding succeeded; begin listening on the port */
-    if (listen(fileDescriptor, 10)) {
+    int fileDescriptor = socket(AF_INET, type, 0);
+    if (fileDescriptor == -1 || (reusePort && setsockopt(fileDescriptor,
+            SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(int))) ||
+            bind(fileDescriptor, addressInfo->ai_addr,
+            sizeof(struct sockaddr))) {
+        if (fileDescriptor != -1) {
+            close(fileDescriptor);
+        }
+        freeaddrinfo(addressInfo);
         return -1;
     }
+    freeaddrinfo(addressInfo);
     return fileDescriptor;
 }
 
@@ -132,144 +1066,3480 @@ in_port_t get_port_number(int fileDescriptor) {
 }
 
 /**
- * Handles a connection to a client, represented as a pthread. Repeatedly
- * attempts to read and process input from the client, until a reading error
- * occurs or the client closes the connection. Input is handled by
- * handle_input.
- * @param vars - a void pointer which can be casted to a type ClientPackage for
- * the retrieval of function arguments.
+ * Runs an event loop which accepts clients from the mapper's listening socket
+ * and serves every client it accepted, until the process exits. Each reactor
+ * owns its own epoll instance; the listening socket is shared between all
+ * reactors, and each connection is only ever handled by the reactor which
+ * accepted it.
+ * @param vars - a void pointer which can be casted to a type Reactor for the
+ * retrieval of function arguments. The pointed to Reactor is copied, so may be
+ * shared between threads.
  * @return - NULL on exit.
  */
-void* client_handler(void* vars) {
-    /* Unpack variables from the ClientPackage which vars points to */
-    ClientPackage clientPackage = *(ClientPackage*)vars;
-    int fileDescriptor = clientPackage.fileDescriptor;
-    sem_t* lock = clientPackage.lock;
-    Airport** airports = clientPackage.airports;
-    int* numAirports = clientPackage.numAirports;
-    /* Open reading and writing streams to the given file descriptor */
-    int fileDescriptorCopy = dup(fileDescriptor);
-    FILE* readStream = fdopen(fileDescriptor, "r");
-    FILE* writeStream = fdopen(fileDescriptorCopy, "w");
-
-    /* Continuously read and process input */
+void* run_reactor(void* vars) {
+    Reactor reactor = *(Reactor*)vars;
+    reactor.epollFileDescriptor = epoll_create1(0);
+    reactor.reader = register_reader(reactor.registry);
+    /* Watch the listening socket; a NULL pointer identifies it in events.
+     * EPOLLEXCLUSIVE ensures only one reactor is woken per new client */
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = NULL;
+    epoll_ctl(reactor.epollFileDescriptor, EPOLL_CTL_ADD,
+            reactor.listenFileDescriptor, &event);
+    /* Watch the reactor's eventfd; a pointer to the reactor itself
+     * identifies it in events */
+    event.events = EPOLLIN;
+    event.data.ptr = &reactor;
+    epoll_ctl(reactor.epollFileDescriptor, EPOLL_CTL_ADD,
+            reactor.wakeFileDescriptor, &event);
+    /* Watch the UDP socket, if there is one; a pointer to its file
+     * descriptor identifies it in events. As with the listening socket,
+     * only one reactor is woken per datagram */
+    DatagramBatch* batch = NULL;
+    if (reactor.datagramFileDescriptor != -1) {
+        batch = calloc(1, sizeof(DatagramBatch));
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = &reactor.datagramFileDescriptor;
+        epoll_ctl(reactor.epollFileDescriptor, EPOLL_CTL_ADD,
+                reactor.datagramFileDescriptor, &event);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
     while (1) {
-        /* Retrieve and verify input */
-        size_t bufferSize = MAX_CHARS + 1; // +1 to include null terminator
-        char* message = malloc(bufferSize * sizeof(char));
-        if (!fgets(message, bufferSize, readStream)) {
-            break; // error reading from client; close connection
+        int numEvents = epoll_wait(reactor.epollFileDescriptor, events,
+                MAX_EVENTS, get_wait_timeout(&reactor));
+        int woken = 0;
+        for (int i = 0; i < numEvents; i++) {
+            Connection* connection = events[i].data.ptr;
+            if (!connection) {
+                accept_clients(&reactor);
+                continue;
+            }
+            if (events[i].data.ptr == &reactor) {
+                woken = 1;
+                continue;
+            }
+            if (events[i].data.ptr == &reactor.datagramFileDescriptor) {
+                answer_datagrams(&reactor, batch);
+                continue;
+            }
+            if (connection->waiter &&
+                    (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                cancel_wait(&reactor, connection); // nobody left to answer
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_output(&reactor, connection);
+                if (connection->subscription) {
+                    deliver_events(&reactor, connection);
+                }
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                receive_input(&reactor, connection);
+            }
+            close_if_finished(&reactor, connection);
+        }
+        /* Handle the eventfd last, since it may close connections which
+         * later events of this batch refer to */
+        if (woken) {
+            wake_reactor(&reactor);
         }
-        message[strlen(message) - 1] = 0; // truncate trailing '\n'
-        size_t len = strlen(message);
-        if ((message[0] == '?' || message[0] == '!') && len < 2) {
-            continue; // message is invalid; ignore
+        if (reactor.firstDeadline) {
+            expire_waiters(&reactor);
         }
+    }
+    return NULL;
+}
+
+/**
+ * Accepts every client waiting on the listening socket, and begins watching
+ * each of them for input using the given reactor's epoll instance.
+ * @param reactor - the reactor which will own the accepted connections.
+ */
+void accept_clients(Reactor* reactor) {
+    int fileDescriptor;
+    while (fileDescriptor = accept4(reactor->listenFileDescriptor, 0, 0,
+            SOCK_NONBLOCK), fileDescriptor >= 0) {
+        Connection* connection = calloc(1, sizeof(Connection));
+        connection->fileDescriptor = fileDescriptor;
+        connection->watchedEvents = EPOLLIN;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events = connection->watchedEvents;
+        event.data.ptr = connection;
+        epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_ADD, fileDescriptor,
+                &event);
+    }
+}
 
-        /* Process input */
-        take_lock(lock);
-        handle_input(message, writeStream, airports, numAirports);
-        release_lock(lock);
+/**
+ * Receives a batch of datagrams from the given reactor's UDP socket, and
+ * sends back a reply datagram to each one holding a lookup ("?ID",
+ * "&ID:ID:..." or "#PORT", optionally newline terminated), as handle_input
+ * would over a connection. Other datagrams, and lookups whose reply would not
+ * fit in a datagram, are ignored. Only one batch is handled per call, so a
+ * flood of datagrams never starves the reactor's connections.
+ * @param reactor - the reactor whose UDP socket is readable.
+ * @param batch - the reactor's buffers for handling the batch.
+ */
+void answer_datagrams(Reactor* reactor, DatagramBatch* batch) {
+    for (int i = 0; i < MAX_DATAGRAMS; i++) {
+        batch->vectors[i] = (struct iovec){batch->inputs[i],
+                MAX_BATCH_CHARS + 1};
+        memset(&batch->messages[i], 0, sizeof(struct mmsghdr));
+        batch->messages[i].msg_hdr.msg_name = &batch->addresses[i];
+        batch->messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->messages[i].msg_hdr.msg_iov = &batch->vectors[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int numReceived = recvmmsg(reactor->datagramFileDescriptor,
+            batch->messages, MAX_DATAGRAMS, MSG_DONTWAIT, NULL);
+    if (numReceived <= 0) {
+        return;
     }
 
-    fclose(readStream);
-    fclose(writeStream);
-    return NULL;
+    /* Handle every lookup, building its reply */
+    int numReplies = 0;
+    enter_registry(reactor->registry, reactor->reader);
+    for (int i = 0; i < numReceived; i++) {
+        char* message = batch->inputs[i];
+        size_t len = batch->messages[i].msg_len;
+        if (batch->messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            continue; // too long to be valid
+        }
+        message[len] = 0;
+        if (len && message[len - 1] == '\n') {
+            message[--len] = 0; // truncate trailing '\n'
+        }
+        if ((message[0] != '?' && message[0] != '&' && message[0] != '#') ||
+                len < 2 || len > max_message_chars(message)) {
+            continue; // not a valid lookup; ignore
+        }
+        Buffer* output = &batch->outputs[i];
+        output->length = 0;
+        handle_input(message, output, reactor->registry);
+        if (output->length > MAX_DATAGRAM_CHARS) {
+            continue; // reply does not fit in a datagram
+        }
+        batch->replyVectors[numReplies] = (struct iovec){output->data,
+                output->length};
+        memset(&batch->replies[numReplies], 0, sizeof(struct mmsghdr));
+        batch->replies[numReplies].msg_hdr.msg_name = &batch->addresses[i];
+        batch->replies[numReplies].msg_hdr.msg_namelen =
+                batch->messages[i].msg_hdr.msg_namelen;
+        batch->replies[numReplies].msg_hdr.msg_iov =
+                &batch->replyVectors[numReplies];
+        batch->replies[numReplies].msg_hdr.msg_iovlen = 1;
+        numReplies++;
+    }
+    leave_registry(reactor->registry, reactor->reader);
+
+    /* Send every reply; a reply the socket has no room for is dropped, as
+     * the network might have dropped it anyway */
+    int numSent = 0;
+    while (numSent < numReplies) {
+        int result = sendmmsg(reactor->datagramFileDescriptor,
+                batch->replies + numSent, numReplies - numSent, MSG_DONTWAIT);
+        if (result > 0) {
+            numSent += result;
+        } else if (result == -1 && errno == EINTR) {
+            continue;
+        } else {
+            numSent++; // skip the reply which could not be sent
+        }
+    }
 }
 
 /**
- * Handles input from a client, according to the following specification:
- * Command      Purpose
- * ?ID          Send the port number for the airport called ID
- * !ID:PORT     Add airport called ID with PORT as the port number
- * @            Send back all names and their corresponding ports
- * @param message - the input from the client to be handled.
- * @param stream - the stream to write to when sending back output.
- * @param airports - an array of all registered airports, to read and add to.
- * @param numAirports - the size of the array of registered airports given.
+ * Reads all input currently available from a client and handles every full
+ * line within it (see frame_lines), then sends back the output of all of
+ * those lines at once. Pipelined commands therefore cost one write between
+ * them, rather than one each. Marks the connection as closing if the client
+ * has closed its end, or as failed if a reading error occurred.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection to read from.
+ */
+void receive_input(Reactor* reactor, Connection* connection) {
+    while (!connection->closing && !connection->failed &&
+            !connection->parked &&
+            connection->output.length < MAX_PENDING_OUTPUT) {
+        ssize_t received = recv(connection->fileDescriptor,
+                connection->input + connection->inputLength,
+                INPUT_CHARS - connection->inputLength, 0);
+        if (received > 0) {
+            connection->inputLength += received;
+            frame_lines(reactor, connection);
+        } else if (received == 0) {
+            connection->closing = 1; // client closed the connection
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection->failed = 1; // error reading from client
+            }
+            break; // no more input available for now
+        }
+    }
+    flush_output(reactor, connection);
+}
+
+/**
+ * Splits the input buffered for a client into newline terminated lines, and
+ * handles each complete line in place with process_line. Any trailing partial
+ * line is moved to the start of the buffer to await the rest of it. Lines
+ * longer than the maximum permitted size of their message are discarded. If a
+ * line parks the connection, every line after it is kept in the buffer until
+ * the connection is resumed.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection whose input to process.
+ */
+void frame_lines(Reactor* reactor, Connection* connection) {
+    char* start = connection->input;
+    char* end = connection->input + connection->inputLength;
+    char* newline;
+    while ((newline = memchr(start, '\n', end - start))) {
+        *newline = 0; // truncate trailing '\n'
+        if (connection->discarding) {
+            connection->discarding = 0; // reached the end of an over-long line
+        } else if ((size_t)(newline - start) <= max_message_chars(start)) {
+            process_line(reactor, connection, start);
+        }
+        start = newline + 1;
+        if (connection->parked) {
+            memmove(connection->input, start, end - start);
+            connection->inputLength = end - start;
+            return;
+        }
+    }
+    /* Keep the partial line, unless it is already too long to be valid */
+    size_t remaining = end - start;
+    if (remaining && remaining > max_message_chars(start)) {
+        connection->discarding = 1;
+    }
+    if (connection->discarding) {
+        remaining = 0;
+    }
+    memmove(connection->input, start, remaining);
+    connection->inputLength = remaining;
+}
+
+/**
+ * Returns the maximum permitted size of a message, which depends on its
+ * command: batched lookups, registrations and deregistrations may be longer
+ * than the rest, as may lookups and paged listings, since their ID or cursor
+ * may be any registered ID (followed by a timeout, for a waiting lookup).
+ * @param message - the message, or the start of it.
+ * @return - the maximum number of chars the message may hold, excluding its
+ * newline.
  */
-void handle_input(char* message, FILE* stream, Airport** airports,
-        int* numAirports) {
+size_t max_message_chars(char* message) {
     if (message[0] == '?') {
-        /* If a registered airport with the given id exists, send back its port
-         * number. Otherwise, send back a semicolon */
-        int index = get_airport_index(&message[1], airports, *numAirports);
-        if (index == -1) {
-            fprintf(stream, ";\n");
-        } else {
-            fprintf(stream, "%s\n", airports[index]->portNumber);
+        return MAX_BATCH_CHARS + WAIT_CHARS;
+    }
+    if (message[0] == '&' || message[0] == '!' || message[0] == '-' ||
+            message[0] == '@') {
+        return MAX_BATCH_CHARS;
+    }
+    return MAX_CHARS;
+}
+
+/**
+ * Verifies and handles a single line of input from a client (without its
+ * trailing newline), queueing any output it produces on the connection.
+ * Input is handled by handle_input.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection the line was received from.
+ * @param message - the null-terminated line to process.
+ */
+void process_line(Reactor* reactor, Connection* connection, char* message) {
+    size_t len = strlen(message);
+    if (connection->subscription) {
+        return; // subscribers only receive events
+    }
+    if ((message[0] == '?' || message[0] == '!' || message[0] == '&' ||
+            message[0] == '-') && len < 2) {
+        return; // message is invalid; ignore
+    }
+
+    /* With a journal, registrations and deregistrations are applied once
+     * they are durable, and the connection is parked until then so that any
+     * reply to a later command acknowledges them. Registrations which would
+     * add nothing (such as those which only renew leases) are applied at
+     * once instead, since there is nothing to journal */
+    if ((message[0] == '!' || message[0] == '-') && reactor->journal) {
+        if (message[0] == '!') {
+            char command[len];
+            strcpy(command, &message[1]);
+            enter_registry(reactor->registry, reactor->reader);
+            int renewed = renew_airports(command, reactor->registry);
+            leave_registry(reactor->registry, reactor->reader);
+            if (renewed) {
+                return;
+            }
         }
-        fflush(stream);
-    } else if (message[0] == '!') {
-        /* Register the airport id and port number specified in the message */
-        add_airport(&message[1], airports, numAirports);
-    } else if (strcmp(message, "@") == 0) {
-        /* Display a list of all registered airport id's and associated port
-         * numbers */
-        for (int i = 0; i < *numAirports; i++) {
-            fprintf(stream, "%s:%s\n", airports[i]->name,
-                    airports[i]->portNumber);
+        connection->awaitedCommit = append_to_journal(reactor->journal,
+                message);
+        connection->parked = 1;
+        connection->nextParked = reactor->parked;
+        reactor->parked = connection;
+        return;
+    }
+
+    /* Process input. Registrations take the locks of the shards they change,
+     * as do subscribing and waiting lookups, briefly; everything else only
+     * reads the registry, so never blocks */
+    enter_registry(reactor->registry, reactor->reader);
+    char* separator = message[0] == '?' ? strchr(message, ':') : NULL;
+    if (strcmp(message, "%") == 0) {
+        subscribe(reactor, connection);
+    } else if (separator) {
+        *separator = 0;
+        char* timeout = separator + 1;
+        wait_for_airport(reactor, connection, &message[1],
+                is_integer(timeout) && strlen(timeout) <= 7 &&
+                atoi(timeout) <= MAX_WAIT_TIME ? atoi(timeout) : 0);
+    } else {
+        handle_input(message, &connection->output, reactor->registry);
+    }
+    leave_registry(reactor->registry, reactor->reader);
+}
+
+/**
+ * Writes as much of a connection's pending output to its socket as the socket
+ * will currently accept. Watches the socket for writability while output
+ * remains, and stops watching it for input while too much output remains.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection to write to.
+ */
+void flush_output(Reactor* reactor, Connection* connection) {
+    Buffer* output = &connection->output;
+    size_t sent = 0;
+    while (sent < output->length && !connection->failed) {
+        ssize_t result = send(connection->fileDescriptor, output->data + sent,
+                output->length - sent, MSG_NOSIGNAL);
+        if (result >= 0) {
+            sent += result;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break; // socket is full; wait until it is writable
+        } else if (errno != EINTR) {
+            connection->failed = 1; // error writing to client
         }
-        fflush(stream);
+    }
+    memmove(output->data, output->data + sent, output->length - sent);
+    output->length -= sent;
+
+    /* Update the events this connection is being watched for */
+    uint32_t events = 0;
+    if (output->length) {
+        events |= EPOLLOUT;
+    }
+    if (output->length < MAX_PENDING_OUTPUT && !connection->closing &&
+            !connection->parked) {
+        events |= EPOLLIN;
+    }
+    if (connection->waiter) {
+        events |= EPOLLRDHUP; // a waiting client may close without sending
+    }
+    if (events != connection->watchedEvents && !connection->failed) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events = events;
+        event.data.ptr = connection;
+        epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_MOD,
+                connection->fileDescriptor, &event);
+        connection->watchedEvents = events;
     }
 }
 
 /**
- * Searches the given array of airports for an entry with id matching the given
- * airport name.
- * @param airportName - the id to search for.
- * @param airports - the array of airports to search within.
- * @param numAirports - the size of the given array of airports.
- * @return - the index of the associated entry if found, else -1.
+ * Stops watching a connection, cancels its subscription (if any), closes its
+ * socket and frees its memory.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection to close.
+ */
+void close_connection(Reactor* reactor, Connection* connection) {
+    if (connection->subscription) {
+        unsubscribe(reactor, connection);
+    }
+    epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_DEL,
+            connection->fileDescriptor, 0);
+    close(connection->fileDescriptor);
+    free(connection->output.data);
+    free(connection);
+}
+
+/**
+ * Closes a connection once it has failed, or once the client has closed its
+ * end and all output has been sent. Parked connections are left open until
+ * they are resumed.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection to check.
+ */
+void close_if_finished(Reactor* reactor, Connection* connection) {
+    if (!connection->parked && (connection->failed ||
+            (connection->closing && !connection->output.length))) {
+        close_connection(reactor, connection);
+    }
+}
+
+/**
+ * Handles the given reactor's eventfd becoming readable, by resuming the
+ * connections waiting on the journal (if any) and delivering queued events
+ * to every subscribed connection.
+ * @param reactor - the reactor whose eventfd is readable.
  */
-int get_airport_index(char* airportName, Airport** airports, int numAirports) {
-    for (int i = 0; i < numAirports; i++) {
-        if (strcmp(airportName, airports[i]->name) == 0) {
-            return i;
+void wake_reactor(Reactor* reactor) {
+    uint64_t numWakes;
+    read(reactor->wakeFileDescriptor, &numWakes, sizeof(uint64_t));
+    if (reactor->journal) {
+        resume_connections(reactor);
+    }
+    if (atomic_load(&reactor->woken)) {
+        resume_waiters(reactor);
+    }
+    Connection* connection = reactor->subscribers;
+    while (connection) {
+        Connection* next = connection->nextSubscriber;
+        deliver_events(reactor, connection);
+        close_if_finished(reactor, connection);
+        connection = next;
+    }
+}
+
+/**
+ * Resumes every parked connection of the given reactor whose registrations
+ * have been committed, handling the input held while it was parked and then
+ * reading any more that has arrived.
+ * @param reactor - the reactor whose journal has committed.
+ */
+void resume_connections(Reactor* reactor) {
+    uint64_t numCommitted = atomic_load(&reactor->journal->numCommitted);
+    Connection* connection = reactor->parked;
+    reactor->parked = NULL;
+    while (connection) {
+        Connection* next = connection->nextParked;
+        if (connection->awaitedCommit > numCommitted) {
+            connection->nextParked = reactor->parked; // still waiting
+            reactor->parked = connection;
+        } else {
+            connection->parked = 0;
+            frame_lines(reactor, connection);
+            receive_input(reactor, connection);
+            close_if_finished(reactor, connection);
         }
+        connection = next;
     }
-    return -1;
 }
 
 /**
- * Takes a command in the form of "ID:PORT", where ID is an airport ID, and
- * PORT is its associated port number, and adds the airport ID and port number
- * to the given array of registered airports, if the ID does not already exist
- * in the array. Airports are inserted into the array such as to maintain
- * lexicographic ordering of airport IDs.
- * @param command - a string containing the airport ID and port number,
- * represented in the syntax "ID:PORT".
- * @param airports - the array of registered airports.
- * @param numAirports - the size of the given array of airports.
+ * Subscribes a connection to changes of the registry. The client is sent
+ * every registered airport, one "ID:PORT" line each in lexicographic order
+ * of ID, followed by a line holding "."; after that, it is sent a "+ID:PORT"
+ * line for every endpoint registered and a "-ID:PORT" line for every
+ * endpoint removed (or expired). Every shard's lock is held just long enough
+ * to take its snapshot and add the subscription, so the listing and the
+ * events line up exactly, and the snapshots are listed after the locks are
+ * released. The caller must have entered the registry.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection to subscribe.
  */
-void add_airport(char command[], Airport** airports, int* numAirports) {
-    /* Process and verify command syntax */
-    char* airportName = strtok(command, ":");
-    if (get_airport_index(airportName, airports, *numAirports) != -1) {
-        return; // id already exists
+void subscribe(Reactor* reactor, Connection* connection) {
+    Registry* registry = reactor->registry;
+    Subscription* subscription = calloc(1, sizeof(Subscription));
+    init_lock(&subscription->lock);
+    subscription->wakeFileDescriptor = reactor->wakeFileDescriptor;
+    Snapshot* snapshots[MAX_SHARDS];
+    for (int i = 0; i < registry->numShards; i++) {
+        take_lock(&registry->shards[i].lock);
+        snapshots[i] = atomic_load(&registry->shards[i].snapshot);
     }
-    char* portNumber = strtok(NULL, ":");
-    if (!portNumber || strlen(portNumber) < 1 || !is_integer(portNumber)) {
-        return; // missing or invalid port number
+    take_lock(&registry->subscriptionsLock);
+    subscription->next = registry->subscriptions;
+    registry->subscriptions = subscription;
+    atomic_fetch_add(&registry->numSubscriptions, 1);
+    release_lock(&registry->subscriptionsLock);
+    for (int i = 0; i < registry->numShards; i++) {
+        release_lock(&registry->shards[i].lock);
     }
-    /* Create new airport with the given id and port number */
-    Airport* airport = malloc(sizeof(Airport));
-    airport->name = airportName;
-    airport->portNumber = portNumber;
-    /* Insert this airport into the correct position in the airports list */
-    // find appropriate index
-    int insertionIndex = 0;
-    while (insertionIndex < *numAirports &&
-            strcmp(airportName, airports[insertionIndex]->name) >= 0) {
-        insertionIndex++;
+    list_snapshots(&connection->output, snapshots, registry->numShards, NULL,
+            NULL, SIZE_MAX, NULL);
+    append_output(&connection->output, ".\n", 2);
+    connection->subscription = subscription;
+    connection->nextSubscriber = reactor->subscribers;
+    reactor->subscribers = connection;
+}
+
+/**
+ * Cancels a connection's subscription to changes of the registry, and frees
+ * the subscription along with any events still queued for it.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the subscribed connection.
+ */
+void unsubscribe(Reactor* reactor, Connection* connection) {
+    Registry* registry = reactor->registry;
+    Subscription* subscription = connection->subscription;
+    take_lock(&registry->subscriptionsLock);
+    Subscription** link = &registry->subscriptions;
+    while (*link != subscription) {
+        link = &(*link)->next;
+    }
+    *link = subscription->next;
+    atomic_fetch_sub(&registry->numSubscriptions, 1);
+    release_lock(&registry->subscriptionsLock);
+    free(subscription->queue.data);
+    free(subscription);
+    connection->subscription = NULL;
+    Connection** subscriber = &reactor->subscribers;
+    while (*subscriber != connection) {
+        subscriber = &(*subscriber)->nextSubscriber;
+    }
+    *subscriber = connection->nextSubscriber;
+}
+
+/**
+ * Moves the events queued for a subscribed connection into its output, and
+ * sends as much of it as the socket will accept. Events are left queued
+ * while too much output remains, so a client which reads slowly lets its
+ * queue fill until it overflows; a connection whose queue has overflowed is
+ * marked as failed.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the subscribed connection.
+ */
+void deliver_events(Reactor* reactor, Connection* connection) {
+    Subscription* subscription = connection->subscription;
+    take_lock(&subscription->lock);
+    if (subscription->dropped) {
+        connection->failed = 1;
+    } else if (connection->output.length < MAX_PENDING_OUTPUT) {
+        append_output(&connection->output, subscription->queue.data,
+                subscription->queue.length);
+        subscription->queue.length = 0;
+    }
+    release_lock(&subscription->lock);
+    flush_output(reactor, connection);
+}
+
+/**
+ * Answers a lookup ("?ID:TIMEOUT") with the port number of the given airport,
+ * waiting up to the given number of milliseconds for it to be registered if
+ * it is not yet. While waiting, the connection is parked, so its later
+ * commands are held until the lookup is answered. The shard's lock is held
+ * while the airport is looked up and the wait begins, so a registration
+ * either precedes the lookup or wakes the waiter. The caller must have
+ * entered the registry.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the connection the lookup came from.
+ * @param airportName - the ID to look up.
+ * @param timeout - the number of milliseconds to wait for; the lookup is
+ * answered at once if 0, or if the registry is frozen.
+ */
+void wait_for_airport(Reactor* reactor, Connection* connection,
+        char* airportName, int timeout) {
+    Registry* registry = reactor->registry;
+    uint64_t hash = hash_id(airportName);
+    Shard* shard = find_shard(hash, registry);
+    take_lock(&shard->lock);
+    Airport* airport = get_airport(airportName, registry);
+    if (airport || !timeout || registry->frozenTable) {
+        release_lock(&shard->lock);
+        char portNumber[MAX_PORT_CHARS + 1] = ";";
+        size_t length = airport ? format_port_number(
+                choose_endpoint(airport)->portNumber, portNumber) : 1;
+        portNumber[length++] = '\n';
+        append_output(&connection->output, portNumber, length);
+        return;
     }
-    // shift all airports with index >= this index one position to the right
-    for (int i = *numAirports - 1; i >= insertionIndex; i--) {
-        airports[i + 1] = airports[i];
+    size_t nameSize = strlen(airportName) + 1;
+    Waiter* waiter = malloc(sizeof(Waiter) + nameSize);
+    memcpy(waiter->airportName, airportName, nameSize);
+    waiter->connection = connection;
+    waiter->reactor = reactor;
+    waiter->deadline = get_milliseconds() + timeout;
+    waiter->hash = hash;
+    waiter->portNumber = 0;
+    waiter->next = shard->waiters;
+    if (waiter->next) {
+        waiter->next->link = &waiter->next;
+    }
+    waiter->link = &shard->waiters;
+    shard->waiters = waiter;
+    release_lock(&shard->lock);
+
+    /* Insert the waiter into the reactor's list by deadline, searching from
+     * the latest deadline, since timeouts are usually alike */
+    Waiter* previous = reactor->lastDeadline;
+    while (previous && previous->deadline > waiter->deadline) {
+        previous = previous->previousDeadline;
+    }
+    waiter->previousDeadline = previous;
+    waiter->nextDeadline = previous ? previous->nextDeadline :
+            reactor->firstDeadline;
+    *(previous ? &previous->nextDeadline : &reactor->firstDeadline) = waiter;
+    *(waiter->nextDeadline ? &waiter->nextDeadline->previousDeadline :
+            &reactor->lastDeadline) = waiter;
+    connection->waiter = waiter;
+    connection->parked = 1;
+}
+
+/**
+ * Wakes every lookup waiting for the given airport's ID, which has just been
+ * registered: each is removed from the shard's list and pushed onto its
+ * reactor's woken stack, and its reactor is woken through its eventfd. The
+ * caller must hold the shard's lock.
+ * @param airport - the airport which was registered.
+ * @param shard - the shard the airport was registered in.
+ */
+void wake_waiters(Airport* airport, Shard* shard) {
+    uint64_t hash = hash_id(airport->name);
+    Waiter* waiter = shard->waiters;
+    while (waiter) {
+        Waiter* next = waiter->next;
+        if (waiter->hash == hash &&
+                strcmp(waiter->airportName, airport->name) == 0) {
+            unlink_waiter(waiter);
+            waiter->portNumber = airport->portNumber;
+            Reactor* reactor = waiter->reactor;
+            waiter->nextWoken = atomic_load(&reactor->woken);
+            while (!atomic_compare_exchange_weak(&reactor->woken,
+                    &waiter->nextWoken, waiter)) {
+            }
+            uint64_t one = 1;
+            write(reactor->wakeFileDescriptor, &one, sizeof(uint64_t));
+        }
+        waiter = next;
+    }
+}
+
+/**
+ * Answers every lookup on the given reactor's woken stack with the port
+ * number its ID was registered with, and resumes their connections.
+ * @param reactor - the reactor which was woken.
+ */
+void resume_waiters(Reactor* reactor) {
+    Waiter* waiter = atomic_exchange(&reactor->woken, NULL);
+    while (waiter) {
+        Waiter* next = waiter->nextWoken;
+        finish_wait(reactor, waiter, waiter->portNumber);
+        waiter = next;
+    }
+}
+
+/**
+ * Fails every lookup of the given reactor whose deadline has passed, unless
+ * its ID has meanwhile been registered (in which case it is answered once
+ * the reactor handles its eventfd).
+ * @param reactor - the reactor whose lookups to expire.
+ */
+void expire_waiters(Reactor* reactor) {
+    uint64_t now = get_milliseconds();
+    Waiter* waiter;
+    while ((waiter = reactor->firstDeadline) && waiter->deadline <= now) {
+        Shard* shard = find_shard(waiter->hash, reactor->registry);
+        take_lock(&shard->lock);
+        int waiting = waiter->link != NULL;
+        if (waiting) {
+            unlink_waiter(waiter);
+        }
+        release_lock(&shard->lock);
+        if (!waiting) {
+            break; // woken; the eventfd is already readable
+        }
+        finish_wait(reactor, waiter, 0);
+    }
+}
+
+/**
+ * Abandons the lookup the given connection is waiting on, once the client
+ * has closed (or shut down its end of) the connection or it has failed, and
+ * marks the connection failed so that the caller closes it. If the lookup has
+ * already been woken, it is left to be answered (and the connection then
+ * closed) as usual.
+ * @param reactor - the reactor which owns the connection.
+ * @param connection - the waiting connection.
+ */
+void cancel_wait(Reactor* reactor, Connection* connection) {
+    Waiter* waiter = connection->waiter;
+    connection->failed = 1;
+    Shard* shard = find_shard(waiter->hash, reactor->registry);
+    take_lock(&shard->lock);
+    int waiting = waiter->link != NULL;
+    if (waiting) {
+        unlink_waiter(waiter);
+    }
+    release_lock(&shard->lock);
+    if (waiting) {
+        remove_deadline(reactor, waiter);
+        free(waiter);
+        connection->waiter = NULL;
+        connection->parked = 0;
+    }
+}
+
+/**
+ * Answers a waiting lookup, frees it, and resumes its connection, processing
+ * any input which was held while it waited. The waiter must already have left
+ * its shard's list.
+ * @param reactor - the reactor which owns the lookup's connection.
+ * @param waiter - the lookup to answer.
+ * @param portNumber - the port number its ID was registered with, or 0 to
+ * answer that the ID is not registered.
+ */
+void finish_wait(Reactor* reactor, Waiter* waiter, uint16_t portNumber) {
+    remove_deadline(reactor, waiter);
+    Connection* connection = waiter->connection;
+    free(waiter);
+    char reply[MAX_PORT_CHARS + 1] = ";";
+    size_t length = portNumber ? format_port_number(portNumber, reply) : 1;
+    reply[length++] = '\n';
+    append_output(&connection->output, reply, length);
+    connection->waiter = NULL;
+    connection->parked = 0;
+    frame_lines(reactor, connection);
+    receive_input(reactor, connection);
+    close_if_finished(reactor, connection);
+}
+
+/**
+ * Removes a waiter from its reactor's list by deadline.
+ * @param reactor - the reactor which owns the waiter.
+ * @param waiter - the waiter to remove.
+ */
+void remove_deadline(Reactor* reactor, Waiter* waiter) {
+    *(waiter->previousDeadline ? &waiter->previousDeadline->nextDeadline :
+            &reactor->firstDeadline) = waiter->nextDeadline;
+    *(waiter->nextDeadline ? &waiter->nextDeadline->previousDeadline :
+            &reactor->lastDeadline) = waiter->previousDeadline;
+}
+
+/**
+ * Removes a waiter from its shard's list. The caller must hold the shard's
+ * lock.
+ * @param waiter - the waiter to remove.
+ */
+void unlink_waiter(Waiter* waiter) {
+    *waiter->link = waiter->next;
+    if (waiter->next) {
+        waiter->next->link = waiter->link;
+    }
+    waiter->link = NULL;
+}
+
+/**
+ * Finds how long the given reactor may wait for events before its earliest
+ * waiting lookup times out.
+ * @param reactor - the reactor about to wait.
+ * @return - the number of milliseconds to wait for, or -1 to wait
+ * indefinitely.
+ */
+int get_wait_timeout(Reactor* reactor) {
+    if (!reactor->firstDeadline) {
+        return -1;
+    }
+    uint64_t now = get_milliseconds();
+    uint64_t deadline = reactor->firstDeadline->deadline;
+    return deadline > now ? deadline - now : 0;
+}
+
+/**
+ * Reads the monotonic clock.
+ * @return - the number of milliseconds since some fixed point in the past.
+ */
+uint64_t get_milliseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+}
+
+/**
+ * Appends chars to the end of a buffer, growing the buffer as required.
+ * @param buffer - the buffer to append to.
+ * @param text - the chars to append.
+ * @param length - the number of chars to append.
+ */
+void append_output(Buffer* buffer, const char* text, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+}
+
+/**
+ * Handles input from a client, according to the following specification. The
+ * caller must have entered the registry.
+ * Command      Purpose
+ * ?ID          Send the port number for the airport called ID; of several
+ *              endpoints, the least loaded, taking turns between equals
+ * ?ID:TIMEOUT  As above, but first wait up to TIMEOUT milliseconds for ID to
+ *              be registered (handled by wait_for_airport rather than here;
+ *              elsewhere, the TIMEOUT is ignored)
+ * &ID:ID:...   Send the port numbers for each airport called ID, in order
+ * #PORT        Send the ID of the airport registered with port PORT
+ * !ID:PORT     Add airport called ID with PORT as the port number, or as
+ *              another endpoint if ID is registered with other port numbers,
+ *              unless PORT is already registered
+ * !ID:PORT:... Add each airport called ID with the PORT following it, or
+ *              renew its lease if it is already registered with PORT
+ * -ID          Remove the airport called ID, with all of its endpoints
+ * -ID:PORT     Remove the endpoint of the airport called ID with port PORT
+ * *ID:PORT:LOAD
+ *              Record LOAD as the load of that endpoint, so that lookups of
+ *              ID prefer its least loaded endpoints
+ * @            Send back all names and their corresponding ports
+ * @COUNT       Send back the first COUNT names and their ports, followed by
+ *              ">CURSOR" if there may be more, or "." if not
+ * @COUNT:CURSOR
+ *              Send back the next COUNT names after CURSOR and their ports,
+ *              followed as above
+ * ^PREFIX      Send back the names starting with PREFIX and their ports,
+ *              followed by "."
+ * ~FROM:TO     Send back the names from FROM up to (but excluding) TO and
+ *              their ports, followed by "."; either may be empty to leave
+ *              that end of the range open
+ * %            Subscribe to changes (handled by subscribe rather than here)
+ * $            Send back the number of seconds each registration is leased
+ *              for, or 0 if registrations are not leased
+ * @param message - the input from the client to be handled.
+ * @param output - the buffer to append to when sending back output.
+ * @param registry - the registry of airports to read and add to.
+ */
+void handle_input(char* message, Buffer* output, Registry* registry) {
+    if (message[0] == '?') {
+        /* If a registered airport with the given id exists, send back its port
+         * number. Otherwise, send back a semicolon */
+        char* separator = strchr(message, ':');
+        if (separator) {
+            *separator = 0; // not waiting, so ignore any timeout
+        }
+        Airport* airport = get_airport(&message[1], registry);
+        if (!airport) {
+            append_output(output, ";\n", 2);
+        } else {
+            char portNumber[MAX_PORT_CHARS + 1];
+            size_t length = format_port_number(
+                    choose_endpoint(airport)->portNumber, portNumber);
+            portNumber[length++] = '\n';
+            append_output(output, portNumber, length);
+        }
+    } else if (message[0] == '&') {
+        /* Send back the port numbers of every airport id in the message */
+        send_port_numbers(&message[1], output, registry);
+    } else if (message[0] == '#') {
+        /* If an airport is registered with the given port number, send back
+         * its id. Otherwise, send back a semicolon */
+        Airport* airport = get_airport_by_port(
+                parse_port_number(&message[1]), registry);
+        if (!airport) {
+            append_output(output, ";\n", 2);
+        } else {
+            append_output(output, airport->name, strlen(airport->name));
+            append_output(output, "\n", 1);
+        }
+    } else if (message[0] == '!' && !registry->frozenTable) {
+        /* Register the airport ids and port numbers specified in the
+         * message */
+        register_airports(&message[1], registry);
+    } else if (message[0] == '-' && !registry->frozenTable) {
+        /* Deregister the airport id specified in the message */
+        deregister_airport(&message[1], registry);
+    } else if (message[0] == '*') {
+        /* Record the load an endpoint reported */
+        report_load(&message[1], registry);
+    } else if (strcmp(message, "$") == 0) {
+        /* Send back the lease time, so that registrations can be renewed
+         * before their leases expire */
+        char leaseTime[MAX_CHARS + 1];
+        append_output(output, leaseTime,
+                sprintf(leaseTime, "%d\n", registry->leaseTime));
+    } else if (strcmp(message, "@") == 0) {
+        /* Display a list of all registered airport id's and associated port
+         * numbers */
+        list_airports(output, registry, NULL, NULL, SIZE_MAX, NULL);
+    } else if (message[0] == '@') {
+        /* Send back the next page of the listing */
+        send_page(&message[1], output, registry);
+    } else if (message[0] == '^') {
+        /* Send back every airport whose id starts with the given prefix. The
+         * ids which follow all of those are the ones at or after the prefix
+         * with its last char incremented (discarding trailing chars which
+         * cannot be incremented) */
+        char* prefix = &message[1];
+        char following[MAX_CHARS + 1];
+        strcpy(following, prefix);
+        size_t length = strlen(following);
+        while (length && (unsigned char)following[length - 1] == UCHAR_MAX) {
+            length--;
+        }
+        following[length] = 0;
+        if (length) {
+            following[length - 1]++;
+        }
+        list_airports(output, registry, prefix, length ? following : NULL,
+                SIZE_MAX, NULL);
+        append_output(output, ".\n", 2);
+    } else if (message[0] == '~') {
+        /* Send back every airport whose id lies within the given range */
+        char* separator = strchr(&message[1], ':');
+        if (separator) {
+            *separator = 0;
+            char* from = &message[1];
+            char* to = separator + 1;
+            list_airports(output, registry, *from ? from : NULL,
+                    *to ? to : NULL, SIZE_MAX, NULL);
+            append_output(output, ".\n", 2);
+        }
+    }
+}
+
+/**
+ * Sends back the port numbers of a list of airports as a single line, in the
+ * form "PORT:PORT:...", in the same order as the airports were given. A
+ * semicolon is sent in place of the port number of any airport which is not
+ * registered. The caller must have entered the registry.
+ * @param airportNames - the colon separated list of airport IDs to look up.
+ * @param output - the buffer to append to when sending back output.
+ * @param registry - the registry of airports to read.
+ */
+void send_port_numbers(char* airportNames, Buffer* output, Registry* registry) {
+    char* airportName = airportNames;
+    while (1) {
+        char* separator = strchr(airportName, ':');
+        if (separator) {
+            *separator = 0;
+        }
+        Airport* airport = get_airport(airportName, registry);
+        if (!airport) {
+            append_output(output, ";", 1);
+        } else {
+            char portNumber[MAX_PORT_CHARS];
+            append_output(output, portNumber, format_port_number(
+                    choose_endpoint(airport)->portNumber, portNumber));
+        }
+        if (!separator) {
+            break;
+        }
+        append_output(output, ":", 1);
+        airportName = separator + 1;
+    }
+    append_output(output, "\n", 1);
+}
+
+/**
+ * Initialises an empty registry. The registry grows as airports are added.
+ * @param registry - the registry to initialise.
+ * @param numShards - the number of shards to partition the registry into.
+ */
+void init_registry(Registry* registry, int numShards) {
+    registry->numShards = numShards;
+    registry->shards = calloc(numShards, sizeof(Shard));
+    for (int i = 0; i < numShards; i++) {
+        Shard* shard = &registry->shards[i];
+        atomic_init(&shard->snapshot, calloc(1, sizeof(Snapshot)));
+        size_t capacity = 64;
+        Index* index = calloc(1, sizeof(Index) + capacity * sizeof(Airport*));
+        index->capacity = capacity;
+        atomic_init(&shard->index, index);
+        shard->numIndexed = 0;
+        shard->numRemoved = 0;
+        init_lock(&shard->lock);
+        shard->retired = NULL;
+        shard->arena.next = NULL;
+        shard->arena.remaining = 0;
+        shard->registry = registry;
+    }
+    atomic_init(&registry->epoch, 1);
+    for (int i = 0; i < MAX_READERS; i++) {
+        atomic_init(&registry->readers[i].epoch, 0);
+    }
+    atomic_init(&registry->numReaders, 0);
+    atomic_init(&registry->numChanges, 0);
+    registry->leaseTime = 0;
+    registry->subscriptions = NULL;
+    atomic_init(&registry->numSubscriptions, 0);
+    init_lock(&registry->subscriptionsLock);
+    registry->sharedTable = NULL;
+    registry->frozenTable = NULL;
+    registry->ports = calloc(UINT16_MAX + 1, sizeof(Airport*));
+}
+
+/**
+ * Allocates a reader slot to the calling thread, in which it announces its
+ * reads of the given registry.
+ * @param registry - the registry the thread will read.
+ * @return - the thread's reader slot.
+ */
+int register_reader(Registry* registry) {
+    int reader = atomic_fetch_add(&registry->numReaders, 1);
+    if (reader >= MAX_READERS) {
+        fprintf(stderr, "Too many registry readers\n");
+        exit(1);
+    }
+    return reader;
+}
+
+/**
+ * Announces that the calling thread is about to read the given registry, such
+ * that no memory it can reach will be freed until it leaves the registry.
+ * @param registry - the registry to read.
+ * @param reader - the calling thread's reader slot.
+ */
+void enter_registry(Registry* registry, int reader) {
+    atomic_store(&registry->readers[reader].epoch,
+            atomic_load(&registry->epoch));
+}
+
+/**
+ * Announces that the calling thread has finished reading the given registry,
+ * and no longer holds any pointers into it.
+ * @param registry - the registry which was read.
+ * @param reader - the calling thread's reader slot.
+ */
+void leave_registry(Registry* registry, int reader) {
+    atomic_store(&registry->readers[reader].epoch, 0);
+}
+
+/**
+ * Schedules memory which has just been unlinked from the given shard to be
+ * freed (or recycled) once no reader can be using it. The caller must hold
+ * the shard's lock.
+ * @param shard - the shard the memory was unlinked from.
+ * @param memory - the memory to free.
+ * @param recycledSize - the size of the memory if it was allocated from the
+ * shard's arena with arena_allocate_recyclable, else 0.
+ */
+void retire(Shard* shard, void* memory, size_t recycledSize) {
+    Retired* retired = malloc(sizeof(Retired));
+    retired->memory = memory;
+    retired->recycledSize = recycledSize;
+    retired->epoch = atomic_load(&shard->registry->epoch);
+    retired->next = shard->retired;
+    shard->retired = retired;
+}
+
+/**
+ * Advances the registry's epoch, then frees (or recycles) all memory retired
+ * by the given shard which was unlinked before the epoch of every reader
+ * currently in the registry. The caller must hold the shard's lock.
+ * @param shard - the shard to reclaim memory from.
+ */
+void reclaim(Shard* shard) {
+    Registry* registry = shard->registry;
+    uint64_t oldest = atomic_fetch_add(&registry->epoch, 1) + 1;
+    int numReaders = atomic_load(&registry->numReaders);
+    for (int i = 0; i < numReaders && i < MAX_READERS; i++) {
+        uint64_t epoch = atomic_load(&registry->readers[i].epoch);
+        if (epoch && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    /* Retired memory is ordered by descending epoch, so everything after the
+     * first freeable entry is freeable too */
+    Retired** link = &shard->retired;
+    while (*link && (*link)->epoch >= oldest) {
+        link = &(*link)->next;
+    }
+    Retired* retired = *link;
+    *link = NULL;
+    while (retired) {
+        Retired* next = retired->next;
+        if (retired->recycledSize) {
+            arena_recycle(&shard->arena, retired->memory,
+                    retired->recycledSize);
+        } else {
+            free(retired->memory);
+        }
+        free(retired);
+        retired = next;
+    }
+}
+
+/**
+ * Hashes an airport ID using 64-bit FNV-1a.
+ * @param airportName - the null-terminated id to hash.
+ * @return - the hash of the given id.
+ */
+uint64_t hash_id(const char* airportName) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* c = airportName; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Returns the shard of the given registry which holds airports with the given
+ * ID hash. The shard is chosen by the upper half of the hash, so that it does
+ * not correlate with the slot chosen by the shard's hash index.
+ * @param hash - the hash of an airport ID (see hash_id).
+ * @param registry - the registry to find the shard within.
+ * @return - the shard.
+ */
+Shard* find_shard(uint64_t hash, Registry* registry) {
+    return &registry->shards[(hash >> 32) % registry->numShards];
+}
+
+/**
+ * Searches the given registry's hash indices for an airport with id matching
+ * the given airport name; only the shard the id hashes to is searched. The
+ * caller must have entered the registry.
+ * @param airportName - the id to search for.
+ * @param registry - the registry to search within.
+ * @return - the associated airport if found, else NULL.
+ */
+Airport* get_airport(char* airportName, Registry* registry) {
+    uint64_t hash = hash_id(airportName);
+    FrozenTable* table = registry->frozenTable;
+    if (table) {
+        if (!table->numAirports) {
+            return NULL;
+        }
+        Airport* airport = table->slots[find_frozen_slot(hash,
+                table->pilots[find_frozen_bucket(hash, table->numBuckets)],
+                table->numAirports)];
+        return strcmp(airportName, airport->name) == 0 ? airport : NULL;
+    }
+    Index* index = atomic_load(&find_shard(hash, registry)->index);
+    size_t mask = index->capacity - 1;
+    Airport* airport;
+    for (size_t slot = hash & mask;
+            (airport = atomic_load(&index->slots[slot]));
+            slot = (slot + 1) & mask) {
+        if (airport != &removedAirport &&
+                strcmp(airportName, airport->name) == 0) {
+            return airport;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Looks up the airport registered with the given port number, in constant
+ * time, using the registry's port numbers. The caller must have entered the
+ * registry.
+ * @param portNumber - the port number to look up, or 0 (which is never
+ * registered).
+ * @param registry - the registry to search within.
+ * @return - the airport registered with the port number, or NULL if none is.
+ */
+Airport* get_airport_by_port(uint16_t portNumber, Registry* registry) {
+    Airport* airport = atomic_load(&registry->ports[portNumber]);
+    return airport == &claimedPort ? NULL : airport;
+}
+
+/**
+ * Chooses which endpoint of a registered ID to answer a lookup with: the one
+ * which last reported the least load, with ties (such as between endpoints
+ * which never report their load) broken by taking turns, as each lookup
+ * starts its search one endpoint further along than the last. The caller
+ * must have entered the registry.
+ * @param airport - the first endpoint of the ID, as found by get_airport.
+ * @return - the chosen endpoint.
+ */
+Airport* choose_endpoint(Airport* airport) {
+    if (!atomic_load(&airport->nextEndpoint)) {
+        return airport; // the only endpoint
+    }
+    Airport* endpoints[MAX_ENDPOINTS];
+    int numEndpoints = 0;
+    for (Airport* endpoint = airport; endpoint && numEndpoints < MAX_ENDPOINTS;
+            endpoint = atomic_load(&endpoint->nextEndpoint)) {
+        endpoints[numEndpoints++] = endpoint;
+    }
+    int start = atomic_fetch_add_explicit(&airport->turn, 1,
+            memory_order_relaxed) % numEndpoints;
+    Airport* chosen = endpoints[start];
+    uint16_t leastLoad = atomic_load_explicit(&chosen->load,
+            memory_order_relaxed);
+    for (int i = 1; i < numEndpoints; i++) {
+        Airport* endpoint = endpoints[(start + i) % numEndpoints];
+        uint16_t load = atomic_load_explicit(&endpoint->load,
+                memory_order_relaxed);
+        if (load < leastLoad) {
+            chosen = endpoint;
+            leastLoad = load;
+        }
+    }
+    return chosen;
+}
+
+/**
+ * Freezes the given registry, building a perfect hash table over its
+ * airports for get_airport to use instead of the shards' hash indices.
+ * Buckets are given pilots largest first, while free slots are plentiful;
+ * each pilot is the first which sends every airport in its bucket to a
+ * distinct free slot. Buckets of a single airport come last, when few slots
+ * are free, so rather than searching for a pilot which finds one, each is
+ * given the next free slot directly (see FROZEN_DIRECT). Must be called
+ * before any readers have been started, and the registry must never change
+ * afterwards, since its shards' hash indices are freed.
+ * @param table - the table to build.
+ * @param registry - the registry to freeze.
+ * @return - 0 if successful, or -1 if none of the first FROZEN_MAX_TRIES
+ * pilots could separate some bucket's airports (in practice, only if their
+ * IDs' hashes collide), in which case the registry is left unfrozen.
+ */
+int freeze_registry(FrozenTable* table, Registry* registry) {
+    /* Gather the first endpoint of every ID and its hash; the rest follow
+     * it in each shard's ordering, and are reached through it */
+    size_t numAirports = 0;
+    for (int i = 0; i < registry->numShards; i++) {
+        numAirports += atomic_load(&registry->shards[i].snapshot)->numAirports;
+    }
+    Airport** airports = malloc((numAirports + 1) * sizeof(Airport*));
+    uint64_t* hashes = malloc((numAirports + 1) * sizeof(uint64_t));
+    size_t numGathered = 0;
+    for (int i = 0; i < registry->numShards; i++) {
+        Snapshot* snapshot = atomic_load(&registry->shards[i].snapshot);
+        Airport* previous = NULL;
+        for (int j = 0; j < snapshot->numBlocks; j++) {
+            Block* block = snapshot->blocks[j];
+            for (int k = 0; k < block->numAirports; k++) {
+                Airport* airport = block->airports[k];
+                if (!previous ||
+                        atomic_load(&previous->nextEndpoint) != airport) {
+                    airports[numGathered] = airport;
+                    hashes[numGathered++] = hash_id(airport->name);
+                }
+                previous = airport;
+            }
+        }
+    }
+    numAirports = numGathered;
+
+    /* Group the airports by bucket, with the buckets in order of descending
+     * size (both by counting sort) */
+    size_t numBuckets = numAirports / FROZEN_BUCKET_SIZE + 1;
+    size_t* bucketStarts = calloc(numBuckets + 1, sizeof(size_t));
+    for (size_t i = 0; i < numAirports; i++) {
+        bucketStarts[find_frozen_bucket(hashes[i], numBuckets) + 1]++;
+    }
+    size_t maxBucketSize = 0;
+    for (size_t i = 0; i < numBuckets; i++) {
+        if (bucketStarts[i + 1] > maxBucketSize) {
+            maxBucketSize = bucketStarts[i + 1];
+        }
+        bucketStarts[i + 1] += bucketStarts[i];
+    }
+    size_t* members = malloc((numAirports + 1) * sizeof(size_t));
+    size_t* filled = calloc(numBuckets, sizeof(size_t));
+    for (size_t i = 0; i < numAirports; i++) {
+        size_t bucket = find_frozen_bucket(hashes[i], numBuckets);
+        members[bucketStarts[bucket] + filled[bucket]++] = i;
+    }
+    size_t* sizeStarts = calloc(maxBucketSize + 2, sizeof(size_t));
+    for (size_t i = 0; i < numBuckets; i++) {
+        sizeStarts[maxBucketSize - filled[i] + 1]++;
+    }
+    for (size_t i = 0; i <= maxBucketSize; i++) {
+        sizeStarts[i + 1] += sizeStarts[i];
+    }
+    size_t* order = malloc(numBuckets * sizeof(size_t));
+    for (size_t i = 0; i < numBuckets; i++) {
+        order[sizeStarts[maxBucketSize - filled[i]]++] = i;
+    }
+
+    /* Find each bucket's pilot */
+    uint32_t* pilots = calloc(numBuckets, sizeof(uint32_t));
+    Airport** slots = calloc(numAirports + 1, sizeof(Airport*));
+    size_t positions[maxBucketSize + 1];
+    size_t nextFree = 0;
+    int failed = 0;
+    for (size_t i = 0; i < numBuckets && !failed; i++) {
+        size_t bucket = order[i];
+        size_t start = bucketStarts[bucket];
+        size_t size = filled[bucket];
+        if (size == 1) {
+            while (slots[nextFree]) {
+                nextFree++;
+            }
+            slots[nextFree] = airports[members[start]];
+            pilots[bucket] = FROZEN_DIRECT | nextFree;
+            continue;
+        }
+        failed = size > 0; // until a pilot is found
+        for (uint32_t pilot = 0; failed && pilot < FROZEN_MAX_TRIES;
+                pilot++) {
+            size_t numPlaced = 0;
+            while (numPlaced < size) {
+                size_t member = members[start + numPlaced];
+                size_t slot = find_frozen_slot(hashes[member], pilot,
+                        numAirports);
+                if (slots[slot]) {
+                    break; // taken by another airport
+                }
+                slots[slot] = airports[member];
+                positions[numPlaced++] = slot;
+            }
+            if (numPlaced == size) {
+                pilots[bucket] = pilot;
+                failed = 0;
+                break;
+            }
+            while (numPlaced) {
+                slots[positions[--numPlaced]] = NULL;
+            }
+        }
+    }
+    free(airports);
+    free(hashes);
+    free(bucketStarts);
+    free(members);
+    free(filled);
+    free(sizeStarts);
+    free(order);
+    if (failed) {
+        free(pilots);
+        free(slots);
+        return -1;
+    }
+    table->numAirports = numAirports;
+    table->numBuckets = numBuckets;
+    table->pilots = pilots;
+    table->slots = slots;
+    registry->frozenTable = table;
+
+    /* Only registrations use the shards' hash indices from now on, so free
+     * them, then hand them and the memory used to build the table back to
+     * the system */
+    for (int i = 0; i < registry->numShards; i++) {
+        free(atomic_load(&registry->shards[i].index));
+        atomic_store(&registry->shards[i].index, NULL);
+    }
+    malloc_trim(0);
+    return 0;
+}
+
+/**
+ * Finds the bucket of a frozen table which an airport belongs to. The hash
+ * is mixed first, since the upper bits of hash_id are poorly spread across
+ * similar short IDs.
+ * @param hash - the hash of the airport's ID.
+ * @param numBuckets - the number of buckets in the table.
+ * @return - the bucket.
+ */
+size_t find_frozen_bucket(uint64_t hash, size_t numBuckets) {
+    return reduce_hash(mix_hash(hash), numBuckets);
+}
+
+/**
+ * Finds the slot of a frozen table which an airport is sent to by the given
+ * pilot, or which the pilot gives directly (see FROZEN_DIRECT).
+ * @param hash - the hash of the airport's ID.
+ * @param pilot - the pilot of the airport's bucket.
+ * @param numSlots - the number of slots in the table.
+ * @return - the slot.
+ */
+size_t find_frozen_slot(uint64_t hash, uint32_t pilot, size_t numSlots) {
+    if (pilot & FROZEN_DIRECT) {
+        return pilot & ~FROZEN_DIRECT;
+    }
+    return reduce_hash(mix_hash(hash ^ mix_hash(pilot)), numSlots);
+}
+
+/**
+ * Scrambles the bits of a hash (using the finaliser of splitmix64), so that
+ * hashes which differ in any bit differ in about half of their bits.
+ * @param hash - the hash to scramble.
+ * @return - the scrambled hash.
+ */
+uint64_t mix_hash(uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * Maps a hash onto the range 0 to range - 1, by its upper bits, without
+ * division.
+ * @param hash - the hash to map.
+ * @param range - the size of the range.
+ * @return - the hash's position within the range.
+ */
+size_t reduce_hash(uint64_t hash, size_t range) {
+    return ((unsigned __int128)hash * range) >> 64;
+}
+
+/**
+ * Adds an airport to the given shard's hash index, using linear probing to
+ * find a free slot, or a slot whose airport was removed. The airport's id
+ * must not already be indexed, and the caller must hold the shard's lock.
+ * @param airport - the airport to index.
+ * @param shard - the shard whose index to add to.
+ */
+void index_airport(Airport* airport, Shard* shard) {
+    // keep the hash table at most half full, so that probe sequences are short
+    Index* index = atomic_load(&shard->index);
+    if (2 * (size_t)(shard->numIndexed + 1) > index->capacity) {
+        grow_index(shard);
+        index = atomic_load(&shard->index);
+    }
+    size_t mask = index->capacity - 1;
+    size_t slot = hash_id(airport->name) & mask;
+    Airport* current;
+    while ((current = atomic_load(&index->slots[slot])) &&
+            current != &removedAirport) {
+        slot = (slot + 1) & mask;
+    }
+    if (current) {
+        shard->numRemoved--;
+    } else {
+        shard->numIndexed++;
+    }
+    atomic_store(&index->slots[slot], airport);
+}
+
+/**
+ * Removes an airport from the given shard's hash index. If its ID has another
+ * endpoint, that takes its slot; otherwise its slot is marked with
+ * removedAirport so that probe sequences passing through the slot are not cut
+ * short. The caller must hold the shard's lock.
+ * @param airport - the indexed airport to remove.
+ * @param shard - the shard whose index to remove from.
+ */
+void unindex_airport(Airport* airport, Shard* shard) {
+    Index* index = atomic_load(&shard->index);
+    size_t mask = index->capacity - 1;
+    size_t slot = hash_id(airport->name) & mask;
+    while (atomic_load(&index->slots[slot]) != airport) {
+        slot = (slot + 1) & mask;
+    }
+    Airport* next = atomic_load(&airport->nextEndpoint);
+    atomic_store(&index->slots[slot], next ? next : &removedAirport);
+    if (!next) {
+        shard->numRemoved++;
+    }
+}
+
+/**
+ * Publishes a new hash index for the given shard, holding every airport in
+ * the current index but none of its removed slots, and retires the old index.
+ * The new index has double the number of slots of the current index, unless
+ * enough airports have been removed that the same number leaves it at most a
+ * quarter full. The caller must hold the shard's lock.
+ * @param shard - the shard whose index to grow.
+ */
+void grow_index(Shard* shard) {
+    Index* old = atomic_load(&shard->index);
+    size_t numAirports = shard->numIndexed - shard->numRemoved;
+    size_t capacity = old->capacity;
+    while (4 * (numAirports + 1) > capacity) {
+        capacity *= 2;
+    }
+    Index* index = calloc(1, sizeof(Index) + capacity * sizeof(Airport*));
+    index->capacity = capacity;
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < old->capacity; i++) {
+        Airport* airport = atomic_load_explicit(&old->slots[i],
+                memory_order_relaxed);
+        if (!airport || airport == &removedAirport) {
+            continue;
+        }
+        size_t slot = hash_id(airport->name) & mask;
+        while (atomic_load_explicit(&index->slots[slot],
+                memory_order_relaxed)) {
+            slot = (slot + 1) & mask;
+        }
+        atomic_init(&index->slots[slot], airport);
+    }
+    shard->numIndexed = numAirports;
+    shard->numRemoved = 0;
+    atomic_store(&shard->index, index);
+    retire(shard, old, 0);
+}
+
+/**
+ * Takes a command in the form of "ID:PORT", or "ID:PORT:ID:PORT:..." to
+ * register several airports at once, where each ID is an airport ID and each
+ * PORT is its associated port number, and adds each airport to the shard of
+ * the given registry its ID hashes to (see add_airport). Each affected shard
+ * is locked once, in turn, and publishes all of its new airports together in
+ * a single new snapshot.
+ * @param command - a string containing the airport IDs and port numbers,
+ * represented in the syntax "ID:PORT:ID:PORT:...".
+ * @param registry - the registry to add to.
+ */
+void register_airports(char command[], Registry* registry) {
+    /* Parse each ID:PORT pair, chaining together the pairs which belong to
+     * each shard in the order they were given */
+    int maxPairs = strlen(command) / 2 + 1;
+    char* airportNames[maxPairs];
+    char* portNumbers[maxPairs];
+    int nextPair[maxPairs];
+    int firstPair[registry->numShards];
+    int lastPair[registry->numShards];
+    for (int i = 0; i < registry->numShards; i++) {
+        firstPair[i] = -1;
+    }
+    int numPairs = 0;
+    char* savePointer = NULL;
+    char* airportName = strtok_r(command, ":", &savePointer);
+    while (airportName) {
+        char* portNumber = strtok_r(NULL, ":", &savePointer);
+        if (!portNumber) {
+            break; // missing port number
+        }
+        int shardIndex = find_shard(hash_id(airportName), registry) -
+                registry->shards;
+        airportNames[numPairs] = airportName;
+        portNumbers[numPairs] = portNumber;
+        nextPair[numPairs] = -1;
+        if (firstPair[shardIndex] == -1) {
+            firstPair[shardIndex] = numPairs;
+        } else {
+            nextPair[lastPair[shardIndex]] = numPairs;
+        }
+        lastPair[shardIndex] = numPairs++;
+        airportName = strtok_r(NULL, ":", &savePointer);
+    }
+
+    /* Register each shard's pairs under a single acquisition of its lock */
+    for (int i = 0; i < registry->numShards; i++) {
+        if (firstPair[i] == -1) {
+            continue;
+        }
+        Shard* shard = &registry->shards[i];
+        take_lock(&shard->lock);
+        Snapshot* update = begin_update(shard);
+        for (int pair = firstPair[i]; pair != -1; pair = nextPair[pair]) {
+            add_airport(airportNames[pair], portNumbers[pair], &update, shard);
+        }
+        publish_update(update, shard);
+        release_lock(&shard->lock);
+    }
+}
+
+/**
+ * Takes a command in the same form as register_airports, and checks whether
+ * registering it would change the given registry: that is, whether any of
+ * its airports would be added (see check_registration). If not, the command
+ * is applied here, renewing the lease of each airport it names which is
+ * already registered. The caller must have entered the registry.
+ * @param command - a string containing the airport IDs and port numbers,
+ * represented in the syntax "ID:PORT:ID:PORT:...", which is modified.
+ * @param registry - the registry to renew the airports of.
+ * @return - 1 if the command was applied, or 0 if it would add an airport,
+ * and so must be registered instead.
+ */
+int renew_airports(char command[], Registry* registry) {
+    char* savePointer = NULL;
+    char* airportName = strtok_r(command, ":", &savePointer);
+    while (airportName) {
+        char* portNumber = strtok_r(NULL, ":", &savePointer);
+        if (!portNumber) {
+            break; // missing port number
+        }
+        Shard* shard = find_shard(hash_id(airportName), registry);
+        Airport* last;
+        take_lock(&shard->lock);
+        int added = check_registration(airportName,
+                parse_port_number(portNumber), shard, &last);
+        release_lock(&shard->lock);
+        if (added) {
+            return 0;
+        }
+        airportName = strtok_r(NULL, ":", &savePointer);
+    }
+    return 1;
+}
+
+/**
+ * Adds an airport with the given ID and port number to an update of the given
+ * shard, if the port number is valid and not already registered (with this
+ * ID or any other). Airports are inserted into the update's blocks such
+ * as to maintain lexicographic ordering of airport IDs, and are added to the
+ * shard's hash index, or if the ID is already registered with other port
+ * numbers, chained after its last endpoint (up to MAX_ENDPOINTS of them). The
+ * airport, its ID and its port number are allocated from the shard's arena,
+ * so the given strings need not outlive this call. If the registry leases
+ * registrations, the new airport is leased, and registering an ID again with
+ * the same port number renews its lease. The ID must hash to the given
+ * shard, and the caller must hold the shard's lock.
+ * @param airportName - the ID of the airport.
+ * @param portNumber - the port number the airport is listening on.
+ * @param update - pointer to the unpublished update to add to.
+ * @param shard - the shard being updated.
+ */
+void add_airport(char* airportName, char* portNumber, Snapshot** update,
+        Shard* shard) {
+    uint16_t port = parse_port_number(portNumber);
+    Airport* last;
+    if (!check_registration(airportName, port, shard, &last)) {
+        return;
+    }
+    Registry* registry = shard->registry;
+    /* Claim the port number, which a registration to another shard may have
+     * claimed since it was checked */
+    Airport* unclaimed = NULL;
+    if (!atomic_compare_exchange_strong(&registry->ports[port], &unclaimed,
+            &claimedPort)) {
+        return; // port number registered to another ID
+    }
+    /* Create new airport with the given id and port number, as one record
+     * which can be recycled once the airport is removed */
+    size_t nameLength = strlen(airportName);
+    size_t size = AIRPORT_SIZE(nameLength);
+    Airport* airport;
+    if (size <= ARENA_MAX_RECYCLED) {
+        airport = arena_allocate_recyclable(&shard->arena, size);
+    } else {
+        airport = arena_allocate(&shard->arena, size, _Alignof(Airport));
+        size = 0; // too large to recycle
+    }
+    memcpy(airport->name, airportName, nameLength + 1);
+    airport->portNumber = port;
+    airport->size = size;
+    airport->lease = NULL;
+    atomic_init(&airport->nextEndpoint, NULL);
+    atomic_init(&airport->load, 0);
+    atomic_init(&airport->turn, 0);
+    atomic_store(&registry->ports[port], airport);
+    /* Insert this airport into the correct position in the shard */
+    if (last) {
+        atomic_store(&last->nextEndpoint, airport);
+    } else {
+        index_airport(airport, shard);
+    }
+    insert_airport(airport, update, shard);
+    record_event('+', airport, shard);
+    if (shard->waiters) {
+        wake_waiters(airport, shard);
+    }
+    if (registry->leaseTime) {
+        lease_airport(airport, shard);
+    }
+}
+
+/**
+ * Checks whether an airport with the given ID and port number may be added
+ * to the given shard: that is, whether the port number is valid and not
+ * already registered (with this ID or any other), and the ID has fewer than
+ * MAX_ENDPOINTS endpoints. If the ID is already registered with the port
+ * number, the lease of that endpoint is renewed. The ID must hash to the
+ * given shard, and the caller must hold the shard's lock.
+ * @param airportName - the ID of the airport.
+ * @param port - the port number of the airport, or 0 if it was invalid.
+ * @param shard - the shard the airport would be added to.
+ * @param last - set to the last endpoint of the ID, or NULL if it is not
+ * registered, if the airport may be added.
+ * @return - 1 if the airport may be added, else 0.
+ */
+int check_registration(char* airportName, uint16_t port, Shard* shard,
+        Airport** last) {
+    /* The airport holding the port number may belong to another shard, and
+     * be freed at any time, so it is only compared with this ID's endpoints,
+     * never read */
+    if (!port) {
+        return 0; // invalid port number
+    }
+    Registry* registry = shard->registry;
+    Airport* holder = atomic_load(&registry->ports[port]);
+    *last = NULL;
+    int numEndpoints = 0;
+    for (Airport* existing = get_airport(airportName, registry);
+            existing; existing = atomic_load(&existing->nextEndpoint)) {
+        if (existing == holder) {
+            if (existing->lease) {
+                cancel_lease(existing->lease);
+                existing->lease->expiry =
+                        shard->wheel.now + registry->leaseTime;
+                schedule_lease(&shard->wheel, existing->lease);
+            }
+            return 0; // endpoint already exists
+        }
+        *last = existing;
+        numEndpoints++;
+    }
+    // port number registered to another ID, or too many endpoints
+    return !holder && numEndpoints < MAX_ENDPOINTS;
+}
+
+/**
+ * Records a change to the given shard in the events of its update in
+ * progress, if the registry has any subscriptions or a shared table:
+ * "+ID:PORT" when an airport (or endpoint) is added, or "-ID:PORT" when it is
+ * removed. The caller must hold the shard's lock.
+ * @param sign - '+' if the airport was added, or '-' if it was removed.
+ * @param airport - the airport which was added or removed.
+ * @param shard - the shard being updated.
+ */
+void record_event(char sign, Airport* airport, Shard* shard) {
+    if (!atomic_load(&shard->registry->numSubscriptions) &&
+            !shard->registry->sharedTable) {
+        return;
+    }
+    append_output(&shard->events, &sign, 1);
+    append_output(&shard->events, airport->name, strlen(airport->name));
+    char portNumber[MAX_PORT_CHARS + 1] = ":";
+    append_output(&shard->events, portNumber,
+            format_port_number(airport->portNumber, &portNumber[1]) + 1);
+    append_output(&shard->events, "\n", 1);
+}
+
+/**
+ * Takes a command in the form of "ID" or "ID:PORT", and removes every
+ * endpoint registered with the given ID from the given registry, or (if a
+ * PORT is given) only the endpoint registered with that port number.
+ * @param command - a string containing the airport ID, and optionally its
+ * port number, represented in the syntax "ID:PORT".
+ * @param registry - the registry to remove from.
+ */
+void deregister_airport(char* command, Registry* registry) {
+    char* savePointer = NULL;
+    char* airportName = strtok_r(command, ":", &savePointer);
+    if (!airportName) {
+        return; // missing id
+    }
+    char* portNumber = strtok_r(NULL, ":", &savePointer);
+    Shard* shard = find_shard(hash_id(airportName), registry);
+    take_lock(&shard->lock);
+    uint16_t port = portNumber ? parse_port_number(portNumber) : 0;
+    Snapshot* update = NULL;
+    Airport* airport = get_airport(airportName, registry);
+    while (airport) {
+        Airport* next = atomic_load(&airport->nextEndpoint);
+        if (!portNumber || port == airport->portNumber) {
+            if (!update) {
+                update = begin_update(shard);
+            }
+            remove_airport(airport, &update, shard);
+        }
+        airport = next;
+    }
+    if (update) {
+        publish_update(update, shard);
+    }
+    release_lock(&shard->lock);
+}
+
+/**
+ * Takes a load report in the form of "ID:PORT:LOAD", and records LOAD as the
+ * load of the endpoint of the given registry registered with that ID and
+ * port number, if there is one, for choose_endpoint to weigh. A LOAD beyond
+ * UINT16_MAX is recorded as UINT16_MAX. Loads are not part of the registry's
+ * ordering, so are recorded in place, without taking the shard's lock. The
+ * caller must have entered the registry.
+ * @param command - a string containing the airport ID, port number and load,
+ * represented in the syntax "ID:PORT:LOAD".
+ * @param registry - the registry holding the endpoint.
+ */
+void report_load(char* command, Registry* registry) {
+    char* savePointer = NULL;
+    char* airportName = strtok_r(command, ":", &savePointer);
+    char* portNumber = strtok_r(NULL, ":", &savePointer);
+    char* load = strtok_r(NULL, ":", &savePointer);
+    if (!load || !is_integer(load)) {
+        return; // missing or invalid load
+    }
+    uint16_t port = parse_port_number(portNumber);
+    uint16_t value = strlen(load) > MAX_PORT_CHARS ||
+            atoi(load) > UINT16_MAX ? UINT16_MAX : atoi(load);
+    for (Airport* airport = get_airport(airportName, registry); airport;
+            airport = atomic_load(&airport->nextEndpoint)) {
+        if (airport->portNumber == port) {
+            atomic_store_explicit(&airport->load, value,
+                    memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+/**
+ * Applies a registration ("!ID:PORT...") or deregistration ("-ID[:PORT]")
+ * message to the given registry, as written to the journal.
+ * @param message - the message, which is modified in place.
+ * @param registry - the registry to update.
+ */
+void apply_registration(char* message, Registry* registry) {
+    if (message[0] == '!') {
+        register_airports(&message[1], registry);
+    } else if (message[0] == '-') {
+        deregister_airport(&message[1], registry);
+    }
+}
+
+/**
+ * Gives an airport which has no lease a new lease in the given shard's timer
+ * wheel, lasting for the registry's lease time. The caller must hold the
+ * shard's lock.
+ * @param airport - the airport to lease.
+ * @param shard - the shard the airport is registered in.
+ */
+void lease_airport(Airport* airport, Shard* shard) {
+    Lease* lease = arena_allocate_recyclable(&shard->arena, sizeof(Lease));
+    lease->airport = airport;
+    lease->expiry = shard->wheel.now + shard->registry->leaseTime;
+    airport->lease = lease;
+    schedule_lease(&shard->wheel, lease);
+}
+
+/**
+ * Adds a lease to the slot of the given timer wheel which it expires in: the
+ * slot, at the lowest level which covers it, of the first tick (at that
+ * level's granularity) in which its expiry differs from the current tick.
+ * @param wheel - the timer wheel to add to.
+ * @param lease - the lease to add, which must not be in a wheel, and must
+ * not expire before the current tick, nor more than MAX_LEASE_TIME after it.
+ */
+void schedule_lease(TimerWheel* wheel, Lease* lease) {
+    uint64_t expiry = lease->expiry;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+            (expiry ^ wheel->now) >> (WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    Lease** slot = &wheel->slots[level][
+            (expiry >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    lease->next = *slot;
+    if (lease->next) {
+        lease->next->link = &lease->next;
+    }
+    lease->link = slot;
+    *slot = lease;
+}
+
+/**
+ * Removes a lease from the timer wheel it is in, if any.
+ * @param lease - the lease to remove.
+ */
+void cancel_lease(Lease* lease) {
+    if (!lease->link) {
+        return;
+    }
+    *lease->link = lease->next;
+    if (lease->next) {
+        lease->next->link = lease->link;
+    }
+    lease->link = NULL;
+}
+
+/**
+ * Advances the given timer wheel by one tick. Whenever the new tick starts a
+ * rotation of a level, the next slot of the level above is emptied and its
+ * leases rescheduled into the levels below.
+ * @param wheel - the timer wheel to advance.
+ * @return - the leases which expire in the new tick, now removed from the
+ * wheel and linked through their next pointers.
+ */
+Lease* advance_wheel(TimerWheel* wheel) {
+    uint64_t now = ++wheel->now;
+    /* Find the highest level whose slot boundary the tick lies on, then
+     * cascade from that level down, so leases fall through every level */
+    int top = 0;
+    while (top < WHEEL_LEVELS - 1 &&
+            !(now & ((1ull << (WHEEL_BITS * (top + 1))) - 1))) {
+        top++;
+    }
+    for (int level = top; level > 0; level--) {
+        Lease** slot = &wheel->slots[level][
+                (now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+        Lease* lease = *slot;
+        *slot = NULL;
+        while (lease) {
+            Lease* next = lease->next;
+            schedule_lease(wheel, lease);
+            lease = next;
+        }
+    }
+    Lease** slot = &wheel->slots[0][now & (WHEEL_SLOTS - 1)];
+    Lease* expired = *slot;
+    *slot = NULL;
+    for (Lease* lease = expired; lease; lease = lease->next) {
+        lease->link = NULL;
+    }
+    return expired;
+}
+
+/**
+ * Repeatedly advances the timer wheel of every shard of the given registry
+ * once a tick (second) has passed, removing the airports whose leases have
+ * expired. Each shard's expired airports are removed together, in a single
+ * new snapshot.
+ * @param vars - the registry to expire the leases of.
+ * @return - NULL, though this function never returns.
+ */
+void* expire_leases(void* vars) {
+    Registry* registry = (Registry*)vars;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+        sleep(1);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t tick = now.tv_sec - start.tv_sec;
+        for (int i = 0; i < registry->numShards; i++) {
+            Shard* shard = &registry->shards[i];
+            take_lock(&shard->lock);
+            Snapshot* update = begin_update(shard);
+            while (shard->wheel.now < tick) {
+                Lease* lease = advance_wheel(&shard->wheel);
+                while (lease) {
+                    Lease* next = lease->next;
+                    remove_airport(lease->airport, &update, shard);
+                    lease = next;
+                }
+            }
+            publish_update(update, shard);
+            release_lock(&shard->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Registers every airport listed in the given file, in which each line takes
+ * the form "ID:PORT" (as sent in response to "@"). Invalid lines are ignored,
+ * as are lines with an ID longer than MAX_BATCH_CHARS (which no registration
+ * could carry) and lines giving a port number which an earlier line gave (for
+ * the same ID or another); an ID given by several lines is registered with
+ * each of their port numbers, as its endpoints. Rather than inserting the
+ * airports one at a time, sorts them once and builds each shard's blocks
+ * directly from the sorted list. Must only be called on an empty registry,
+ * before any readers have been started.
+ * @param file - the file to read registrations from.
+ * @param registry - the registry to add to.
+ * @return - the number of airports registered.
+ */
+int load_airports(FILE* file, Registry* registry) {
+    /* Read every valid registration into one contiguous pool of records,
+     * such that the address of each airport reflects its position in the
+     * file */
+    Buffer pool = {NULL, 0, 0};
+    size_t numLoaded = 0;
+    size_t maxLoaded = 1024;
+    size_t* offsets = malloc(maxLoaded * sizeof(size_t));
+    char* portsGiven = calloc(UINT16_MAX + 1, sizeof(char));
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    while ((length = getline(&line, &lineSize, file)) != -1) {
+        if (length && line[length - 1] == '\n') {
+            line[length - 1] = 0; // truncate trailing '\n'
+        }
+        char* savePointer = NULL;
+        char* airportName = strtok_r(line, ":", &savePointer);
+        char* portNumber = strtok_r(NULL, ":", &savePointer);
+        uint16_t port = portNumber ? parse_port_number(portNumber) : 0;
+        if (!airportName || !port || strlen(airportName) > MAX_BATCH_CHARS) {
+            continue; // invalid registration; ignore
+        }
+        if (portsGiven[port]) {
+            continue; // port number given by an earlier line; ignore
+        }
+        portsGiven[port] = 1;
+        if (numLoaded == maxLoaded) {
+            maxLoaded *= 2;
+            offsets = realloc(offsets, maxLoaded * sizeof(size_t));
+        }
+        offsets[numLoaded++] = pool_airport(&pool, airportName,
+                strlen(airportName), port);
+    }
+    free(line);
+    free(portsGiven);
+
+    /* Sort the airports by ID, then by position in the file. The pool is
+     * complete, so is trimmed and never moves again */
+    pool.data = realloc(pool.data, pool.length ? pool.length : 1);
+    Airport** sorted = malloc(numLoaded * sizeof(Airport*));
+    for (size_t i = 0; i < numLoaded; i++) {
+        sorted[i] = (Airport*)(pool.data + offsets[i]);
+    }
+    free(offsets);
+    qsort(sorted, numLoaded, sizeof(Airport*), compare_airports);
+    int numAirports = build_registry(sorted, numLoaded, registry);
+    free(sorted);
+    return numAirports;
+}
+
+/**
+ * Fills an empty registry with the given airports, building each shard's
+ * blocks and hash index directly. Where several airports share an ID, they
+ * are registered as its endpoints, in the order given, up to MAX_ENDPOINTS.
+ * An airport whose port number is already registered (to an earlier airport,
+ * by order of ID, whether of the same ID or not) is left out. If the
+ * registry leases registrations, every registered airport is given a fresh
+ * lease. Must be called before any readers have been started.
+ * @param sorted - the airports to register, sorted by ID.
+ * @param numSorted - the number of airports in sorted.
+ * @param registry - the registry to fill.
+ * @return - the number of airports registered.
+ */
+int build_registry(Airport** sorted, size_t numSorted, Registry* registry) {
+    /* Keep only the airports with unregistered port numbers, registering
+     * them, and find the shard each of them belongs to */
+    size_t numLoaded = numSorted;
+    int numShards = registry->numShards;
+    int* shardIndices = malloc(numLoaded * sizeof(int));
+    uint64_t* hashes = malloc(numLoaded * sizeof(uint64_t));
+    char* chained = malloc(numLoaded ? numLoaded : 1);
+    int shardSizes[numShards];
+    memset(shardSizes, 0, sizeof(shardSizes));
+    size_t first = 0;
+    int numEndpoints = 0;
+    for (size_t i = 0; i < numLoaded; i++) {
+        if (!i || strcmp(sorted[i]->name, sorted[i - 1]->name)) {
+            numEndpoints = 0; // a new ID
+        }
+        _Atomic(Airport*)* port = &registry->ports[sorted[i]->portNumber];
+        if (atomic_load(port) || numEndpoints == MAX_ENDPOINTS) {
+            shardIndices[i] = -1; // port taken, or too many endpoints
+            continue;
+        }
+        atomic_store(port, sorted[i]);
+        chained[i] = numEndpoints++ > 0;
+        if (chained[i]) {
+            hashes[i] = hashes[first];
+            shardIndices[i] = shardIndices[first];
+        } else {
+            first = i;
+            hashes[i] = hash_id(sorted[i]->name);
+            shardIndices[i] = find_shard(hashes[i], registry) -
+                    registry->shards;
+        }
+        shardSizes[shardIndices[i]]++;
+    }
+
+    /* Size each shard's hash index up front, so it never has to grow while
+     * being filled */
+    for (int i = 0; i < numShards; i++) {
+        Shard* shard = &registry->shards[i];
+        Index* index = atomic_load(&shard->index);
+        size_t capacity = index->capacity;
+        while (capacity < 2 * (size_t)shardSizes[i]) {
+            capacity *= 2;
+        }
+        if (capacity != index->capacity) {
+            free(index);
+            index = calloc(1, sizeof(Index) + capacity * sizeof(Airport*));
+            index->capacity = capacity;
+            atomic_store(&shard->index, index);
+        }
+    }
+
+    /* Fill each shard's blocks in order */
+    Snapshot* snapshots[numShards];
+    Block* blocks[numShards];
+    for (int i = 0; i < numShards; i++) {
+        int maxBlocks = shardSizes[i] / BLOCK_SIZE + 1;
+        snapshots[i] = calloc(1, sizeof(Snapshot) +
+                maxBlocks * sizeof(Block*));
+        snapshots[i]->maxBlocks = maxBlocks;
+        blocks[i] = NULL;
+    }
+    int numAirports = 0;
+    Airport* last = NULL;
+    for (size_t i = 0; i < numLoaded; i++) {
+        /* Airports are indexed in order of ID rather than of hash, so fetch
+         * the index slot of an upcoming airport ahead of time */
+        size_t upcoming = i + INDEX_PREFETCH_DISTANCE;
+        if (upcoming < numLoaded && shardIndices[upcoming] != -1) {
+            Index* index = atomic_load(
+                    &registry->shards[shardIndices[upcoming]].index);
+            __builtin_prefetch(
+                    &index->slots[hashes[upcoming] & (index->capacity - 1)]);
+        }
+        int shardIndex = shardIndices[i];
+        if (shardIndex == -1) {
+            continue;
+        }
+        Snapshot* snapshot = snapshots[shardIndex];
+        Block* block = blocks[shardIndex];
+        if (!block || block->numAirports == BLOCK_SIZE) {
+            block = blocks[shardIndex] = calloc(1, sizeof(Block));
+            snapshot->blocks[snapshot->numBlocks++] = block;
+        }
+        block->airports[block->numAirports++] = sorted[i];
+        snapshot->numAirports++;
+        if (chained[i]) {
+            atomic_store(&last->nextEndpoint, sorted[i]);
+        } else {
+            index_airport(sorted[i], &registry->shards[shardIndex]);
+        }
+        last = sorted[i];
+        if (registry->leaseTime) {
+            lease_airport(sorted[i], &registry->shards[shardIndex]);
+        }
+        numAirports++;
+    }
+    free(shardIndices);
+    free(hashes);
+    free(chained);
+
+    /* Publish every shard's snapshot */
+    for (int i = 0; i < numShards; i++) {
+        for (int j = 0; j < snapshots[i]->numBlocks; j++) {
+            serialise_block(snapshots[i]->blocks[j]);
+        }
+        Shard* shard = &registry->shards[i];
+        free(atomic_load(&shard->snapshot));
+        atomic_store(&shard->snapshot, snapshots[i]);
+    }
+    return numAirports;
+}
+
+/**
+ * Restores a registry from a snapshot file (see SnapshotHeader). The file is
+ * mapped into memory, and its records are packed straight into one
+ * contiguous pool of airport records, sized up front, after which the
+ * mapping is released. Must only be called on an empty registry, before any
+ * readers have been started.
+ * @param fileDescriptor - the snapshot file, open for reading.
+ * @param registry - the registry to restore.
+ * @return - the number of airports registered, or -1 if the file is not a
+ * valid snapshot file.
+ */
+int map_snapshot_file(int fileDescriptor, Registry* registry) {
+    struct stat status;
+    if (fstat(fileDescriptor, &status) ||
+            (size_t)status.st_size < sizeof(SnapshotHeader)) {
+        return -1;
+    }
+    char* mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE,
+            fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    SnapshotHeader* header = (SnapshotHeader*)mapping;
+    char* records = mapping + sizeof(SnapshotHeader);
+    char* end = mapping + status.st_size;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+            header->recordsLength != (uint64_t)(end - records) ||
+            header->numAirports > header->recordsLength / 4) {
+        munmap(mapping, status.st_size);
+        return -1;
+    }
+
+    /* Pack an airport record for each file record, checking they are in
+     * order (the endpoints of an ID being in order of registration). Every
+     * record holds at least a port number and two null terminators, so the
+     * pool never outgrows its initial capacity */
+    size_t numAirports = header->numAirports;
+    Buffer pool = {NULL, 0, numAirports * (offsetof(Airport, name) +
+            _Alignof(Airport)) + header->recordsLength};
+    pool.data = malloc(pool.capacity ? pool.capacity : 1);
+    Airport** sorted = malloc(numAirports * sizeof(Airport*));
+    char* record = records;
+    char* previous = NULL;
+    size_t numPacked = 0;
+    for (size_t i = 0; i < numAirports; i++) {
+        char* nameEnd = memchr(record, 0, end - record);
+        char* portEnd = nameEnd ? memchr(nameEnd + 1, 0, end - nameEnd - 1) :
+                NULL;
+        uint16_t port = portEnd ? parse_port_number(nameEnd + 1) : 0;
+        if (!port || (previous && strcmp(previous, record) > 0)) {
+            break;
+        }
+        sorted[i] = (Airport*)(pool.data +
+                pool_airport(&pool, record, nameEnd - record, port));
+        previous = record;
+        record = portEnd + 1;
+        numPacked++;
+    }
+    munmap(mapping, status.st_size);
+    if (numPacked != numAirports || record != end) {
+        free(pool.data);
+        free(sorted);
+        return -1;
+    }
+    int numRegistered = build_registry(sorted, numAirports, registry);
+    free(sorted);
+    return numRegistered;
+}
+
+/**
+ * Rewrites the snapshot file whenever the registry has changed since it was
+ * last written, checking every SNAPSHOT_INTERVAL seconds. After each rewrite,
+ * removes the registrations the snapshot now holds from the journal, if there
+ * is one. Never returns.
+ * @param vars - the SnapshotWriter describing the file and registry.
+ * @return NULL.
+ */
+void* write_snapshot_files(void* vars) {
+    SnapshotWriter* writer = (SnapshotWriter*)vars;
+    int reader = register_reader(writer->registry);
+    while (1) {
+        uint64_t numChanges = atomic_load(&writer->registry->numChanges);
+        if (numChanges != writer->numSaved) {
+            /* Every journalled registration written so far has already been
+             * applied, so will be held by the snapshot */
+            off_t covered = 0;
+            if (writer->journal) {
+                take_lock(&writer->journal->fileLock);
+                covered = writer->journal->length;
+                release_lock(&writer->journal->fileLock);
+            }
+            if (!save_snapshot_file(writer->path, writer->registry, reader)) {
+                writer->numSaved = numChanges;
+                if (covered) {
+                    compact_journal(writer->journal, covered);
+                }
+            }
+        }
+        sleep(SNAPSHOT_INTERVAL);
+    }
+    return NULL;
+}
+
+/**
+ * Writes every airport in the given registry to a snapshot file at the given
+ * path. The file is written in full under a temporary name and then renamed
+ * over the old file, so the file at the path is always complete.
+ * @param path - the path of the snapshot file.
+ * @param registry - the registry to save.
+ * @param reader - the reader slot to announce registry reads in.
+ * @return - 0 if the file was written, else -1.
+ */
+int save_snapshot_file(char* path, Registry* registry, int reader) {
+    /* Take the listing of the registry, and turn each "ID:PORT\n" line of it
+     * into a record by terminating the ID and port number */
+    Buffer listing = {NULL, 0, 0};
+    enter_registry(registry, reader);
+    list_airports(&listing, registry, NULL, NULL, SIZE_MAX, NULL);
+    leave_registry(registry, reader);
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.numAirports = 0;
+    header.recordsLength = listing.length;
+    char* line = listing.data;
+    char* end = listing.data + listing.length;
+    while (line < end) {
+        char* lineEnd = memchr(line, '\n', end - line);
+        char* separator = lineEnd ? memchr(line, ':', lineEnd - line) : NULL;
+        if (!separator) {
+            free(listing.data); // malformed listing; keep the old file
+            return -1;
+        }
+        *separator = 0;
+        *lineEnd = 0;
+        header.numAirports++;
+        line = lineEnd + 1;
+    }
+
+    /* Write the file under a temporary name, then replace the old file */
+    char temporaryPath[strlen(path) + 5];
+    sprintf(temporaryPath, "%s.tmp", path);
+    FILE* file = fopen(temporaryPath, "w");
+    if (!file) {
+        free(listing.data);
+        return -1;
+    }
+    int failed = fwrite(&header, sizeof(SnapshotHeader), 1, file) != 1 ||
+            (listing.length &&
+            fwrite(listing.data, listing.length, 1, file) != 1) ||
+            fflush(file) || fsync(fileno(file));
+    failed |= fclose(file);
+    free(listing.data);
+    if (failed || rename(temporaryPath, path)) {
+        unlink(temporaryPath);
+        return -1;
+    }
+    return sync_directory(path);
+}
+
+/**
+ * Syncs the directory holding the file at the given path, so that a file
+ * just renamed into it survives a crash.
+ * @param path - the path of the file.
+ * @return - 0 if the directory was synced, else -1.
+ */
+int sync_directory(char* path) {
+    char directory[strlen(path) + 2];
+    strcpy(directory, path);
+    char* separator = strrchr(directory, '/');
+    if (separator) {
+        separator[1] = 0;
+    } else {
+        strcpy(directory, ".");
+    }
+    int fileDescriptor = open(directory, O_RDONLY);
+    if (fileDescriptor == -1) {
+        return -1;
+    }
+    int failed = fsync(fileDescriptor);
+    close(fileDescriptor);
+    return failed ? -1 : 0;
+}
+
+/**
+ * Opens (creating if necessary) the journal file at the given path, and
+ * replays every registration and deregistration it holds into the given
+ * registry, in the order they were journalled. A trailing partial line, left
+ * by a crash part way through a commit, was never acknowledged so is removed.
+ * Must be called before any readers have been started.
+ * @param journal - the journal to initialise.
+ * @param path - the path of the journal file.
+ * @param registry - the registry to replay into and later commit to.
+ * @return - 0 if successful, or -1 if the file could not be opened.
+ */
+int open_journal(Journal* journal, char* path, Registry* registry) {
+    journal->path = path;
+    journal->registry = registry;
+    journal->fileDescriptor = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    FILE* file = journal->fileDescriptor == -1 ? NULL :
+            fdopen(dup(journal->fileDescriptor), "r");
+    if (!file) {
+        return -1;
+    }
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    off_t replayed = 0;
+    while ((length = getline(&line, &lineSize, file)) != -1 &&
+            line[length - 1] == '\n') {
+        line[length - 1] = 0; // truncate trailing '\n'
+        apply_registration(line, registry);
+        replayed += length;
+    }
+    free(line);
+    fclose(file);
+    if (ftruncate(journal->fileDescriptor, replayed)) {
+        return -1;
+    }
+    journal->length = replayed;
+    init_lock(&journal->fileLock);
+    init_lock(&journal->lock);
+    sem_init(&journal->ready, 0, 0);
+    journal->pending = (Buffer){NULL, 0, 0};
+    journal->numAppended = 0;
+    atomic_init(&journal->numCommitted, 0);
+    return 0;
+}
+
+/**
+ * Appends registrations (or a deregistration) to the journal's pending batch,
+ * to be made durable and applied by the next commit.
+ * @param journal - the journal to append to.
+ * @param registrations - the message, in the form "!ID:PORT:..." or
+ * "-ID[:PORT]".
+ * @return - the number of messages which must be committed before this one
+ * has been.
+ */
+uint64_t append_to_journal(Journal* journal, char* registrations) {
+    take_lock(&journal->lock);
+    int wasEmpty = !journal->pending.length;
+    append_output(&journal->pending, registrations, strlen(registrations));
+    append_output(&journal->pending, "\n", 1);
+    uint64_t numAppended = ++journal->numAppended;
+    release_lock(&journal->lock);
+    if (wasEmpty) {
+        sem_post(&journal->ready);
+    }
+    return numAppended;
+}
+
+/**
+ * Repeatedly takes the whole pending batch of the journal, writes it to the
+ * journal file and syncs it, then applies it to the registry and wakes every
+ * reactor. Registrations appended while a commit is in progress are gathered
+ * into the next one, so a single sync covers many of them. Never returns.
+ * @param vars - the Journal to commit.
+ * @return NULL.
+ */
+void* commit_registrations(void* vars) {
+    Journal* journal = (Journal*)vars;
+    Buffer batch = {NULL, 0, 0};
+    while (1) {
+        /* Swap the pending batch for an empty one */
+        while (sem_wait(&journal->ready) == -1 && errno == EINTR) {
+        }
+        take_lock(&journal->lock);
+        Buffer swap = journal->pending;
+        journal->pending = batch;
+        batch = swap;
+        uint64_t numAppended = journal->numAppended;
+        release_lock(&journal->lock);
+        if (!batch.length) {
+            continue;
+        }
+
+        /* Make the batch durable, then apply it */
+        take_lock(&journal->fileLock);
+        size_t written = 0;
+        while (written < batch.length) {
+            ssize_t result = write(journal->fileDescriptor,
+                    batch.data + written, batch.length - written);
+            if (result >= 0) {
+                written += result;
+            } else if (errno != EINTR) {
+                fprintf(stderr, "Unable to write journal\n");
+                exit(4); // acknowledging would break the durability promise
+            }
+        }
+        if (fdatasync(journal->fileDescriptor)) {
+            fprintf(stderr, "Unable to write journal\n");
+            exit(4);
+        }
+        journal->length += batch.length;
+        char* line = batch.data;
+        char* end = batch.data + batch.length;
+        while (line < end) {
+            char* newline = memchr(line, '\n', end - line);
+            *newline = 0;
+            apply_registration(line, journal->registry);
+            line = newline + 1;
+        }
+        atomic_store(&journal->numCommitted, numAppended);
+        release_lock(&journal->fileLock);
+        batch.length = 0;
+
+        /* Wake every reactor, so that they resume the connections waiting on
+         * this commit */
+        uint64_t wake = 1;
+        for (int i = 0; i < journal->numReactors; i++) {
+            write(journal->wakeFileDescriptors[i], &wake, sizeof(uint64_t));
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Removes the first chars of the journal file, which hold registrations that
+ * a snapshot file now holds. The remainder of the journal is written to a new
+ * file under a temporary name, which then replaces the journal file.
+ * @param journal - the journal to compact.
+ * @param covered - the number of chars at the start of the journal file which
+ * are no longer needed.
+ * @return - 0 if the journal was compacted, else -1.
+ */
+int compact_journal(Journal* journal, off_t covered) {
+    take_lock(&journal->fileLock);
+    size_t remaining = journal->length - covered;
+    char* tail = malloc(remaining + 1);
+    char temporaryPath[strlen(journal->path) + 5];
+    sprintf(temporaryPath, "%s.tmp", journal->path);
+    int fileDescriptor = -1;
+    int failed = pread(journal->fileDescriptor, tail, remaining, covered) !=
+            (ssize_t)remaining ||
+            (fileDescriptor = open(temporaryPath,
+            O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) == -1 ||
+            write(fileDescriptor, tail, remaining) != (ssize_t)remaining ||
+            fdatasync(fileDescriptor) ||
+            rename(temporaryPath, journal->path);
+    free(tail);
+    if (failed) {
+        if (fileDescriptor != -1) {
+            close(fileDescriptor);
+            unlink(temporaryPath);
+        }
+        release_lock(&journal->fileLock);
+        return -1;
+    }
+    close(journal->fileDescriptor);
+    journal->fileDescriptor = fileDescriptor;
+    journal->length = remaining;
+    release_lock(&journal->fileLock);
+    return sync_directory(journal->path);
+}
+
+/**
+ * Creates (replacing any left by an earlier mapper) the shared memory segment
+ * of the mapper listening on the given port, and fills it with every airport
+ * in the given registry. Must be called before any registrations can occur.
+ * @param table - the shared table to initialise.
+ * @param portNumber - the port the mapper is listening on.
+ * @param registry - the registry to copy.
+ * @return - 0 if successful, or -1 if the segment could not be created.
+ */
+int create_shared_table(SharedTable* table, in_port_t portNumber,
+        Registry* registry) {
+    sprintf(table->name, SHARED_NAME_FORMAT, portNumber);
+    table->fileDescriptor = shm_open(table->name, O_RDWR | O_CREAT | O_TRUNC,
+            0644);
+    if (table->fileDescriptor == -1) {
+        return -1;
+    }
+    table->header = NULL;
+    table->size = 0;
+    init_lock(&table->lock);
+    Buffer listing = {NULL, 0, 0};
+    size_t numAirports = list_airports(&listing, registry, NULL, NULL,
+            SIZE_MAX, NULL);
+    if (resize_shared_table(table, numAirports, listing.length)) {
+        free(listing.data);
+        return -1;
+    }
+    memcpy(table->header->magic, SHARED_MAGIC, sizeof(table->header->magic));
+    table->header->processID = getpid();
+    table->header->startTime = get_start_time(getpid());
+    /* Add each "ID:PORT" line of the listing, except those of IDs with
+     * several endpoints (see share_events) */
+    char* line = listing.data;
+    char* end = listing.data + listing.length;
+    while (line < end) {
+        char* newline = memchr(line, '\n', end - line);
+        char* separator = memchr(line, ':', newline - line);
+        *newline = 0;
+        *separator = 0;
+        if (!atomic_load(&get_airport(line, registry)->nextEndpoint)) {
+            share_airport(table, line, separator + 1);
+        }
+        line = newline + 1;
+    }
+    free(listing.data);
+    return 0;
+}
+
+/**
+ * Removes the shared memory segment of the mapper's shared table, so that it
+ * does not outlive the mapper. Rocs which still have it mapped can keep
+ * reading it. Registered with atexit.
+ */
+void remove_shared_table(void) {
+    shm_unlink(exitingTable->name);
+}
+
+/**
+ * Waits for the mapper to be sent any of the given signals, which every
+ * thread blocks, then removes its shared memory segment and terminates it
+ * with the signal, as it would have been had the signal not been blocked.
+ * @param vars - the set of signals to wait for.
+ * @return - NULL, though this function never returns.
+ */
+void* await_termination(void* vars) {
+    sigset_t* signals = (sigset_t*)vars;
+    int signalNumber;
+    sigwait(signals, &signalNumber);
+    remove_shared_table();
+    signal(signalNumber, SIG_DFL);
+    pthread_sigmask(SIG_UNBLOCK, signals, NULL);
+    raise(signalNumber);
+    return NULL;
+}
+
+/**
+ * Reads the time the given process started at, in clock ticks since the host
+ * booted, from /proc. Together with its process ID, this identifies the
+ * process, since process IDs are reused.
+ * @param processID - the process to read the start time of.
+ * @return - the start time, or 0 if it could not be read (such as when there
+ * is no such process).
+ */
+uint64_t get_start_time(pid_t processID) {
+    char path[32];
+    sprintf(path, "/proc/%d/stat", (int)processID);
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    char status[1024];
+    size_t length = fread(status, 1, sizeof(status) - 1, file);
+    fclose(file);
+    status[length] = 0;
+    /* The start time is the 22nd field. The second field, the process's
+     * name, is parenthesised and may hold spaces and parentheses itself, so
+     * fields are counted from the last ')' */
+    char* field = strrchr(status, ')');
+    for (int i = 2; field && i < 22; i++) {
+        field = strchr(field + 1, ' ');
+    }
+    return field ? strtoull(field + 1, NULL, 10) : 0;
+}
+
+/**
+ * Applies the events of a published update (see record_event) to the given
+ * shared table, as a single change under its seqlock. Each changed ID is
+ * shared with the port number of its only endpoint, or left out if it now
+ * has none or several, so that clients ask the mapper to choose between
+ * them. The caller must hold the lock of the shard which was updated.
+ * @param table - the shared table to change.
+ * @param events - the events, one "+ID:PORT" or "-ID:PORT" per line.
+ * @param registry - the registry the update was published to.
+ */
+void share_events(SharedTable* table, Buffer* events, Registry* registry) {
+    take_lock(&table->lock);
+    atomic_fetch_add_explicit(&table->header->sequence, 1,
+            memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    char* line = events->data;
+    char* end = events->data + events->length;
+    while (line < end) {
+        char* newline = memchr(line, '\n', end - line);
+        char* separator = memchr(line, ':', newline - line);
+        *separator = 0;
+        unshare_airport(table, &line[1]);
+        Airport* airport = get_airport(&line[1], registry);
+        if (airport && !atomic_load(&airport->nextEndpoint)) {
+            char portNumber[MAX_PORT_CHARS + 1];
+            portNumber[format_port_number(airport->portNumber, portNumber)] = 0;
+            share_airport(table, &line[1], portNumber);
+        }
+        *separator = ':';
+        line = newline + 1;
+    }
+    atomic_fetch_add_explicit(&table->header->sequence, 1,
+            memory_order_release);
+    release_lock(&table->lock);
+}
+
+/**
+ * Adds an airport to the given shared table, first growing the table if it
+ * is too full or out of room for strings. The airport's ID must not already
+ * be in the table. The caller must hold the table's lock, with its sequence
+ * odd.
+ * @param table - the shared table to add to.
+ * @param airportName - the ID of the airport.
+ * @param portNumber - the port number of the airport.
+ */
+void share_airport(SharedTable* table, char* airportName, char* portNumber) {
+    size_t nameSize = strlen(airportName) + 1;
+    size_t portSize = strlen(portNumber) + 1;
+    SharedHeader* header = table->header;
+    if (2 * (header->numFilled + 1) > header->capacity ||
+            header->stringsLength + nameSize + portSize >
+            header->stringsCapacity) {
+        if (resize_shared_table(table, header->numAirports + 1,
+                nameSize + portSize)) {
+            return; // out of memory; the airport is only missing from here
+        }
+        header = table->header;
+    }
+    uint64_t hash = hash_id(airportName);
+    SharedSlot* slots = (SharedSlot*)(header + 1);
+    char* strings = (char*)(slots + header->capacity);
+    size_t mask = header->capacity - 1;
+    size_t slot = hash & mask;
+    while (slots[slot].name && slots[slot].name != SHARED_REMOVED) {
+        slot = (slot + 1) & mask;
+    }
+    if (!slots[slot].name) {
+        header->numFilled++;
+    }
+    slots[slot].hash = hash;
+    slots[slot].name = header->stringsLength;
+    memcpy(strings + header->stringsLength, airportName, nameSize);
+    header->stringsLength += nameSize;
+    slots[slot].portNumber = header->stringsLength;
+    memcpy(strings + header->stringsLength, portNumber, portSize);
+    header->stringsLength += portSize;
+    header->numAirports++;
+}
+
+/**
+ * Removes the airport with the given ID from the given shared table, if it
+ * is there. Its strings are left in place until the table is next resized.
+ * The caller must hold the table's lock, with its sequence odd.
+ * @param table - the shared table to remove from.
+ * @param airportName - the ID of the airport.
+ */
+void unshare_airport(SharedTable* table, char* airportName) {
+    SharedSlot* slot = find_shared_slot(table->header, airportName,
+            hash_id(airportName));
+    if (slot) {
+        slot->name = SHARED_REMOVED;
+        table->header->numAirports--;
+    }
+}
+
+/**
+ * Searches a shared table's hash table for the airport with the given ID.
+ * @param header - the header of the shared table.
+ * @param airportName - the ID to search for.
+ * @param hash - the hash of the ID.
+ * @return - the slot holding the airport, or NULL if it is not there.
+ */
+SharedSlot* find_shared_slot(SharedHeader* header, char* airportName,
+        uint64_t hash) {
+    SharedSlot* slots = (SharedSlot*)(header + 1);
+    char* strings = (char*)(slots + header->capacity);
+    size_t mask = header->capacity - 1;
+    for (size_t slot = hash & mask; slots[slot].name;
+            slot = (slot + 1) & mask) {
+        if (slots[slot].name != SHARED_REMOVED && slots[slot].hash == hash &&
+                strcmp(strings + slots[slot].name, airportName) == 0) {
+            return &slots[slot];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Rebuilds the given shared table with room for at least the given number of
+ * airports and chars of strings beyond those of the airports it holds,
+ * dropping its removed slots and their strings, and growing the segment if
+ * it must. The segment is only ever grown, so that clients which mapped it
+ * earlier can always read as much as they mapped. If the table has no
+ * segment mapped yet, it is mapped. The caller must hold the table's lock,
+ * with its sequence odd, unless no clients can have mapped the segment yet.
+ * @param table - the shared table to rebuild.
+ * @param numSlots - the number of airports to make room for, in total.
+ * @param numChars - the number of chars of strings to make room for, beyond
+ * the strings of the airports already in the table.
+ * @return - 0 if successful, or -1 if the segment could not be grown.
+ */
+int resize_shared_table(SharedTable* table, size_t numSlots,
+        size_t numChars) {
+    /* Copy out the airports in the table */
+    SharedHeader* header = table->header;
+    Buffer airports = {NULL, 0, 0};
+    if (header) {
+        SharedSlot* slots = (SharedSlot*)(header + 1);
+        char* strings = (char*)(slots + header->capacity);
+        for (size_t i = 0; i < header->capacity; i++) {
+            if (slots[i].name && slots[i].name != SHARED_REMOVED) {
+                append_output(&airports, strings + slots[i].name,
+                        strlen(strings + slots[i].name) + 1);
+                append_output(&airports, strings + slots[i].portNumber,
+                        strlen(strings + slots[i].portNumber) + 1);
+            }
+        }
+    }
+
+    /* Size the table at most a quarter full, with room for twice the
+     * strings, and grow the segment to fit */
+    size_t capacity = SHARED_MIN_SLOTS;
+    while (capacity < 4 * (numSlots + 1)) {
+        capacity *= 2;
+    }
+    size_t stringsCapacity = 2 * (airports.length + numChars) + 1;
+    if (stringsCapacity < SHARED_MIN_STRINGS) {
+        stringsCapacity = SHARED_MIN_STRINGS;
+    }
+    if (stringsCapacity > UINT32_MAX - 1) {
+        free(airports.data);
+        return -1; // too large for the offsets of a slot
+    }
+    size_t size = sizeof(SharedHeader) + capacity * sizeof(SharedSlot) +
+            stringsCapacity;
+    if (size < table->size) {
+        /* Never shrink the segment; give any spare room to strings */
+        stringsCapacity += table->size - size;
+        size = table->size;
+        if (stringsCapacity > UINT32_MAX - 1) {
+            stringsCapacity = UINT32_MAX - 1;
+        }
+    }
+    if (size > table->size) {
+        if (ftruncate(table->fileDescriptor, size)) {
+            free(airports.data);
+            return -1;
+        }
+        void* mapping = header ?
+                mremap(header, table->size, size, MREMAP_MAYMOVE) :
+                mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                table->fileDescriptor, 0);
+        if (mapping == MAP_FAILED) {
+            free(airports.data);
+            return -1;
+        }
+        table->header = header = mapping;
+        table->size = size;
+    }
+
+    /* Refill the table with the airports copied out */
+    header->capacity = capacity;
+    header->stringsCapacity = stringsCapacity;
+    header->stringsLength = 1;
+    header->numFilled = 0;
+    header->numAirports = 0;
+    memset(header + 1, 0, capacity * sizeof(SharedSlot));
+    char* string = airports.data;
+    char* end = airports.data + airports.length;
+    while (string < end) {
+        char* portNumber = string + strlen(string) + 1;
+        share_airport(table, string, portNumber);
+        string = portNumber + strlen(portNumber) + 1;
+    }
+    free(airports.data);
+    return 0;
+}
+
+/**
+ * Compares two airports for qsort, by ID and then by address.
+ * @param first - pointer to the first airport pointer to compare.
+ * @param second - pointer to the second airport pointer to compare.
+ * @return - a negative number, zero or a positive number if the first airport
+ * precedes, equals or follows the second respectively.
+ */
+int compare_airports(const void* first, const void* second) {
+    Airport* firstAirport = *(Airport* const*)first;
+    Airport* secondAirport = *(Airport* const*)second;
+    int comparison = strcmp(firstAirport->name, secondAirport->name);
+    if (comparison) {
+        return comparison;
+    }
+    return (firstAirport > secondAirport) - (firstAirport < secondAirport);
+}
+
+/**
+ * Binary searches the given snapshot for the block which an airport with the
+ * given id belongs in: the last block whose first airport does not follow the
+ * id, or the first block if every block follows it.
+ * @param airportName - the id to search for.
+ * @param snapshot - the snapshot to search within; must hold a block.
+ * @return - the index of the block the id belongs in.
+ */
+int find_block(char* airportName, Snapshot* snapshot) {
+    int low = 0;
+    int high = snapshot->numBlocks - 1;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (strcmp(airportName, snapshot->blocks[middle]->airports[0]->name)
+                < 0) {
+            high = middle - 1;
+        } else {
+            low = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * Binary searches the given block for the position of the first airport whose
+ * id follows the given id.
+ * @param airportName - the id to search for.
+ * @param block - the block to search within.
+ * @return - the position the id would be inserted at to keep the block sorted.
+ */
+int find_position(char* airportName, Block* block) {
+    int low = 0;
+    int high = block->numAirports;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (strcmp(airportName, block->airports[middle]->name) < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+/**
+ * Begins an update of the given shard, as a private copy of its current
+ * snapshot which shares all of its blocks. The caller must hold the shard's
+ * lock until the update is published.
+ * @param shard - the shard to update.
+ * @return - the unpublished update.
+ */
+Snapshot* begin_update(Shard* shard) {
+    Snapshot* current = atomic_load(&shard->snapshot);
+    int maxBlocks = current->numBlocks + 4;
+    Snapshot* update = malloc(sizeof(Snapshot) + maxBlocks * sizeof(Block*));
+    update->numAirports = current->numAirports;
+    update->changed = 0;
+    update->numBlocks = current->numBlocks;
+    update->maxBlocks = maxBlocks;
+    memcpy(update->blocks, current->blocks,
+            current->numBlocks * sizeof(Block*));
+    return update;
+}
+
+/**
+ * Inserts an airport into an unpublished update of the given shard, such as
+ * to maintain lexicographic ordering of airport IDs. A published block is
+ * copied before it is first modified (see modify_block). A full block is split
+ * in half before inserting into it, so only the airports within a single
+ * block are shifted. The caller must hold the shard's lock.
+ * @param airport - the airport to insert.
+ * @param update - pointer to the update to insert into; may be reallocated.
+ * @param shard - the shard being updated.
+ */
+void insert_airport(Airport* airport, Snapshot** update, Shard* shard) {
+    Snapshot* snapshot = *update;
+    if (snapshot->numBlocks == snapshot->maxBlocks) {
+        snapshot->maxBlocks *= 2;
+        snapshot = realloc(snapshot, sizeof(Snapshot) +
+                snapshot->maxBlocks * sizeof(Block*));
+        *update = snapshot;
+    }
+    if (!snapshot->numBlocks) {
+        snapshot->blocks[snapshot->numBlocks++] = calloc(1, sizeof(Block));
+        snapshot->blocks[0]->unpublished = 1;
+    }
+    int blockIndex = find_block(airport->name, snapshot);
+    Block* block = modify_block(snapshot, blockIndex, shard);
+    if (block->numAirports == BLOCK_SIZE) {
+        /* Move the upper half of the full block into a new block directly
+         * after it */
+        Block* upper = calloc(1, sizeof(Block));
+        upper->unpublished = 1;
+        upper->numAirports = BLOCK_SIZE / 2;
+        block->numAirports = BLOCK_SIZE - upper->numAirports;
+        memcpy(upper->airports, block->airports + block->numAirports,
+                upper->numAirports * sizeof(Airport*));
+        memmove(snapshot->blocks + blockIndex + 2,
+                snapshot->blocks + blockIndex + 1,
+                (snapshot->numBlocks - blockIndex - 1) * sizeof(Block*));
+        snapshot->blocks[blockIndex + 1] = upper;
+        snapshot->numBlocks++;
+        if (strcmp(airport->name, upper->airports[0]->name) >= 0) {
+            block = upper;
+        }
+    }
+    // shift all airports after the insertion point one position to the right
+    int position = find_position(airport->name, block);
+    memmove(block->airports + position + 1, block->airports + position,
+            (block->numAirports - position) * sizeof(Airport*));
+    block->airports[position] = airport;
+    block->numAirports++;
+    snapshot->numAirports++;
+    snapshot->changed = 1;
+}
+
+/**
+ * Removes an airport from an unpublished update of the given shard, from the
+ * shard's hash index or its ID's endpoints, and from the registry's port
+ * numbers, then retires the airport (if it was allocated by a registration)
+ * and recycles its lease (if any). A block left empty is dropped from the
+ * update. The caller must hold the shard's lock.
+ * @param airport - the registered airport to remove.
+ * @param update - pointer to the update to remove from.
+ * @param shard - the shard being updated.
+ */
+void remove_airport(Airport* airport, Snapshot** update, Shard* shard) {
+    Snapshot* snapshot = *update;
+    record_event('-', airport, shard);
+    atomic_store(&shard->registry->ports[airport->portNumber], NULL);
+    /* The first endpoint of an ID leaves the hash index (to the next, if
+     * any); any other is unlinked from the endpoint before it */
+    Airport* previous = get_airport(airport->name, shard->registry);
+    if (previous == airport) {
+        unindex_airport(airport, shard);
+    } else {
+        while (atomic_load(&previous->nextEndpoint) != airport) {
+            previous = atomic_load(&previous->nextEndpoint);
+        }
+        atomic_store(&previous->nextEndpoint,
+                atomic_load(&airport->nextEndpoint));
+    }
+    /* Find the airport among the last run of airports in the block which do
+     * not follow its ID; the run (of its ID's endpoints) may begin in an
+     * earlier block */
+    int blockIndex = find_block(airport->name, snapshot);
+    int position = find_position(airport->name,
+            snapshot->blocks[blockIndex]) - 1;
+    while (snapshot->blocks[blockIndex]->airports[position] != airport) {
+        if (!position--) {
+            position = snapshot->blocks[--blockIndex]->numAirports - 1;
+        }
+    }
+    Block* block = modify_block(snapshot, blockIndex, shard);
+    memmove(block->airports + position, block->airports + position + 1,
+            (block->numAirports - position - 1) * sizeof(Airport*));
+    block->numAirports--;
+    snapshot->numAirports--;
+    snapshot->changed = 1;
+    if (!block->numAirports) {
+        free(block); // unpublished, so no reader can see it
+        memmove(snapshot->blocks + blockIndex,
+                snapshot->blocks + blockIndex + 1,
+                (snapshot->numBlocks - blockIndex - 1) * sizeof(Block*));
+        snapshot->numBlocks--;
+    }
+    if (airport->lease) {
+        cancel_lease(airport->lease);
+        arena_recycle(&shard->arena, airport->lease, sizeof(Lease));
+    }
+    if (airport->size) {
+        retire(shard, airport, airport->size);
+    }
+}
+
+/**
+ * Prepares a block of an unpublished update to be modified. A published
+ * block is replaced in the update by a copy (and the original retired), so
+ * readers never see it change.
+ * @param snapshot - the update holding the block.
+ * @param blockIndex - the index of the block within the update.
+ * @param shard - the shard being updated.
+ * @return - the block, which may now be modified.
+ */
+Block* modify_block(Snapshot* snapshot, int blockIndex, Shard* shard) {
+    Block* block = snapshot->blocks[blockIndex];
+    if (!block->unpublished) {
+        Block* copy = malloc(sizeof(Block));
+        *copy = *block;
+        copy->listing = NULL;
+        copy->unpublished = 1;
+        retire(shard, block->listing, 0);
+        retire(shard, block, 0);
+        snapshot->blocks[blockIndex] = block = copy;
+    }
+    return block;
+}
+
+/**
+ * Publishes an update as the given shard's current snapshot, serialising
+ * every block the update changed, then retires the replaced snapshot and
+ * reclaims whatever memory readers can no longer see, and passes the
+ * update's events on to the shared table and subscribers. An update which
+ * changed nothing is discarded instead. The caller must hold the shard's
+ * lock.
+ * @param update - the update to publish.
+ * @param shard - the shard being updated.
+ */
+void publish_update(Snapshot* update, Shard* shard) {
+    Snapshot* old = atomic_load(&shard->snapshot);
+    if (!update->changed) {
+        free(update);
+        return;
+    }
+    for (int i = 0; i < update->numBlocks; i++) {
+        if (update->blocks[i]->unpublished) {
+            serialise_block(update->blocks[i]);
+            update->blocks[i]->unpublished = 0;
+        }
+    }
+    atomic_store(&shard->snapshot, update);
+    atomic_fetch_add(&shard->registry->numChanges, 1);
+    retire(shard, old, 0);
+    reclaim(shard);
+    if (shard->events.length) {
+        if (shard->registry->sharedTable) {
+            share_events(shard->registry->sharedTable, &shard->events,
+                    shard->registry);
+        }
+        queue_events(shard);
+    }
+}
+
+/**
+ * Appends the events of the given shard's just published update to the
+ * queue of every subscription, then empties them. A subscription whose queue
+ * would grow beyond SUBSCRIPTION_QUEUE_CHARS is dropped instead, so a slow
+ * subscriber never holds up registrations. The reactor owning a subscription
+ * is woken whenever its queue stops being empty (or it is dropped). The
+ * caller must hold the shard's lock.
+ * @param shard - the shard which was updated.
+ */
+void queue_events(Shard* shard) {
+    Registry* registry = shard->registry;
+    Buffer* events = &shard->events;
+    take_lock(&registry->subscriptionsLock);
+    for (Subscription* subscription = registry->subscriptions; subscription;
+            subscription = subscription->next) {
+        take_lock(&subscription->lock);
+        int wake = 0;
+        if (!subscription->dropped && subscription->queue.length +
+                events->length > SUBSCRIPTION_QUEUE_CHARS) {
+            subscription->dropped = 1;
+            free(subscription->queue.data);
+            subscription->queue = (Buffer){NULL, 0, 0};
+            wake = 1;
+        } else if (!subscription->dropped) {
+            wake = !subscription->queue.length;
+            append_output(&subscription->queue, events->data, events->length);
+        }
+        release_lock(&subscription->lock);
+        if (wake) {
+            uint64_t one = 1;
+            write(subscription->wakeFileDescriptor, &one, sizeof(uint64_t));
+        }
+    }
+    release_lock(&registry->subscriptionsLock);
+    events->length = 0;
+}
+
+/**
+ * Builds the listing of the given block, as sent in response to "@". The
+ * block's previous listing (if any) is not freed.
+ * @param block - the block to serialise.
+ */
+void serialise_block(Block* block) {
+    size_t nameLengths[BLOCK_SIZE];
+    size_t listingLength = 0;
+    for (int i = 0; i < block->numAirports; i++) {
+        nameLengths[i] = strlen(block->airports[i]->name);
+        listingLength += nameLengths[i] + MAX_PORT_CHARS + 2; // ':' and '\n'
+    }
+    char* listing = malloc(listingLength);
+    char* end = listing;
+    for (int i = 0; i < block->numAirports; i++) {
+        memcpy(end, block->airports[i]->name, nameLengths[i]);
+        end += nameLengths[i];
+        *end++ = ':';
+        end += format_port_number(block->airports[i]->portNumber, end);
+        *end++ = '\n';
+        block->lineEnds[i] = end - listing;
+    }
+    block->listingLength = end - listing;
+    block->listing = realloc(listing, block->listingLength ?
+            block->listingLength : 1);
+}
+
+/**
+ * Sends back every airport in the given registry whose ID lies within the
+ * given range, in lexicographic order of ID, one "ID:PORT" line each. Each
+ * shard's snapshot is binary searched for the range, then the shards'
+ * orderings are merged using a min-heap of cursors, copying each airport's
+ * line from its block's listing; once a single shard remains, the rest of its
+ * range is copied from its listings whole. The time taken is therefore
+ * proportional to the number of airports sent, not to the size of the
+ * registry. The caller must have entered the registry.
+ * @param output - the buffer to append to when sending back output.
+ * @param registry - the registry to list.
+ * @param from - the first ID in the range, or NULL to start from the first
+ * registered ID.
+ * @param to - the ID following the range (which is itself excluded), or NULL
+ * to continue to the last registered ID.
+ * @param limit - the number of airports after which to stop, once the
+ * endpoints of the last ID sent are finished (so that they are never split).
+ * @param last - if not NULL, set to the ID of the last airport sent (left
+ * unchanged if none were sent).
+ * @return - the number of airports sent.
+ */
+size_t list_airports(Buffer* output, Registry* registry, char* from, char* to,
+        size_t limit, char** last) {
+    Snapshot* snapshots[MAX_SHARDS];
+    for (int i = 0; i < registry->numShards; i++) {
+        snapshots[i] = atomic_load(&registry->shards[i].snapshot);
+    }
+    return list_snapshots(output, snapshots, registry->numShards, from, to,
+            limit, last);
+}
+
+/**
+ * Sends back every airport in the given shard snapshots whose ID lies within
+ * the given range, as described by list_airports. The caller must have
+ * entered the registry before the snapshots were taken.
+ * @param output - the buffer to append to when sending back output.
+ * @param snapshots - a snapshot of each shard.
+ * @param numSnapshots - the number of snapshots.
+ * @param from - the first ID in the range, or NULL to start from the first
+ * ID.
+ * @param to - the ID following the range (which is itself excluded), or NULL
+ * to continue to the last ID.
+ * @param limit - the maximum number of airports to send.
+ * @param last - if not NULL, set to the ID of the last airport sent (left
+ * unchanged if none were sent).
+ * @return - the number of airports sent.
+ */
+size_t list_snapshots(Buffer* output, Snapshot** snapshots, int numSnapshots,
+        char* from, char* to, size_t limit, char** last) {
+    /* Build a heap of cursors, one per shard holding airports in range */
+    Cursor heap[MAX_SHARDS];
+    int heapSize = 0;
+    for (int i = 0; i < numSnapshots; i++) {
+        Cursor cursor = {snapshots[i], 0, 0, 0, 0};
+        cursor.endBlock = cursor.snapshot->numBlocks;
+        if (from) {
+            find_first(from, cursor.snapshot, &cursor.blockIndex,
+                    &cursor.position);
+        }
+        if (to) {
+            find_first(to, cursor.snapshot, &cursor.endBlock,
+                    &cursor.endPosition);
+        }
+        if (cursor.blockIndex < cursor.endBlock ||
+                (cursor.blockIndex == cursor.endBlock &&
+                cursor.position < cursor.endPosition)) {
+            heap[heapSize++] = cursor;
+        }
+    }
+    for (int i = heapSize / 2 - 1; i >= 0; i--) {
+        sift_down(heap, heapSize, i);
+    }
+    /* Repeatedly send the first airport of the cursor with the smallest ID,
+     * continuing past the limit to finish the ID being sent */
+    size_t numSent = 0;
+    char* lastName = NULL;
+    while (heapSize > 1 && (numSent < limit ||
+            (lastName && strcmp(cursor_name(&heap[0]), lastName) == 0))) {
+        Cursor* cursor = &heap[0];
+        Block* block = cursor->snapshot->blocks[cursor->blockIndex];
+        size_t start = cursor->position ?
+                block->lineEnds[cursor->position - 1] : 0;
+        append_output(output, block->listing + start,
+                block->lineEnds[cursor->position] - start);
+        lastName = block->airports[cursor->position]->name;
+        numSent++;
+        if (++cursor->position == block->numAirports) {
+            cursor->position = 0;
+            cursor->blockIndex++;
+        }
+        if (cursor->blockIndex == cursor->endBlock &&
+                cursor->position == cursor->endPosition) {
+            heap[0] = heap[--heapSize]; // shard's range has been listed
+        }
+        sift_down(heap, heapSize, 0);
+    }
+    if (heapSize) {
+        Cursor* cursor = &heap[0];
+        for (int i = cursor->blockIndex; i <= cursor->endBlock &&
+                i < cursor->snapshot->numBlocks; i++) {
+            Block* block = cursor->snapshot->blocks[i];
+            int first = i == cursor->blockIndex ? cursor->position : 0;
+            int end = i == cursor->endBlock ? cursor->endPosition :
+                    block->numAirports;
+            int stop = end;
+            size_t remaining = numSent < limit ? limit - numSent : 0;
+            if ((size_t)(end - first) > remaining) {
+                stop = first + remaining;
+                char* finishing = remaining ? block->airports[stop - 1]->name :
+                        lastName;
+                while (finishing && stop < end &&
+                        strcmp(block->airports[stop]->name, finishing) == 0) {
+                    stop++;
+                }
+            }
+            if (stop > first) {
+                size_t startChar = first ? block->lineEnds[first - 1] : 0;
+                append_output(output, block->listing + startChar,
+                        block->lineEnds[stop - 1] - startChar);
+                lastName = block->airports[stop - 1]->name;
+                numSent += stop - first;
+            }
+            if (stop < end) {
+                break; // the limit was reached
+            }
+        }
+    }
+    if (last && lastName) {
+        *last = lastName;
+    }
+    return numSent;
+}
+
+/**
+ * Sends back one page of the listing of the given registry, as requested by
+ * "@COUNT" or "@COUNT:CURSOR": up to COUNT airports (or a few more, to
+ * finish the last ID's endpoints), in lexicographic order of ID, starting
+ * after the ID given as CURSOR (or from the first airport if there is no
+ * cursor). The page is followed by a line holding ">" and the cursor to
+ * request the next page with if at least COUNT airports were sent, or a line
+ * holding "." if the end of the listing was reached. The caller must have
+ * entered the registry.
+ * @param request - the request following the "@", as "COUNT" or
+ * "COUNT:CURSOR".
+ * @param output - the buffer to append to when sending back output.
+ * @param registry - the registry to list.
+ */
+void send_page(char* request, Buffer* output, Registry* registry) {
+    char* cursor = strchr(request, ':');
+    if (cursor) {
+        *cursor++ = 0;
+    }
+    if (!is_integer(request) || atoi(request) < 1) {
+        return; // invalid page size; ignore
+    }
+    size_t limit = atoi(request);
+    /* The first ID after the cursor is the cursor followed by the smallest
+     * possible char */
+    char* from = NULL;
+    char following[cursor ? strlen(cursor) + 2 : 1];
+    if (cursor) {
+        sprintf(following, "%s\001", cursor);
+        from = following;
+    }
+    char* last = NULL;
+    if (list_airports(output, registry, from, NULL, limit, &last) < limit) {
+        append_output(output, ".\n", 2);
+    } else {
+        append_output(output, ">", 1);
+        append_output(output, last, strlen(last));
+        append_output(output, "\n", 1);
+    }
+}
+
+/**
+ * Binary searches the given snapshot for the first airport whose ID does not
+ * precede the given ID.
+ * @param airportName - the ID to search for.
+ * @param snapshot - the snapshot to search within.
+ * @param blockIndex - set to the index of the block holding the airport, or
+ * to the number of blocks if every airport precedes the ID.
+ * @param position - set to the position of the airport within its block.
+ */
+void find_first(char* airportName, Snapshot* snapshot, int* blockIndex,
+        int* position) {
+    *blockIndex = 0;
+    *position = 0;
+    if (!snapshot->numBlocks) {
+        return;
+    }
+    *blockIndex = find_block(airportName, snapshot);
+    /* The endpoints of the ID may begin in an earlier block, which then ends
+     * with the ID */
+    while (*blockIndex) {
+        Block* previous = snapshot->blocks[*blockIndex - 1];
+        if (strcmp(previous->airports[previous->numAirports - 1]->name,
+                airportName) < 0) {
+            break;
+        }
+        (*blockIndex)--;
+    }
+    Block* block = snapshot->blocks[*blockIndex];
+    int low = 0;
+    int high = block->numAirports;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (strcmp(block->airports[middle]->name, airportName) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *position = low;
+    if (*position == block->numAirports) {
+        (*blockIndex)++; // every airport in the block precedes the ID
+        *position = 0;
+    }
+}
+
+/**
+ * Returns the ID of the airport a cursor is positioned at.
+ * @param cursor - the cursor.
+ * @return - the ID of the cursor's current airport.
+ */
+char* cursor_name(Cursor* cursor) {
+    Block* block = cursor->snapshot->blocks[cursor->blockIndex];
+    return block->airports[cursor->position]->name;
+}
+
+/**
+ * Restores the min-heap ordering (by current airport ID) of the subtree of a
+ * heap of cursors rooted at the given position, given that only the cursor
+ * at that position may be out of place.
+ * @param heap - the heap of cursors.
+ * @param heapSize - the number of cursors in the heap.
+ * @param parent - the position of the subtree's root.
+ */
+void sift_down(Cursor* heap, int heapSize, int parent) {
+    while (1) {
+        int smallest = parent;
+        for (int child = 2 * parent + 1; child <= 2 * parent + 2 &&
+                child < heapSize; child++) {
+            if (strcmp(cursor_name(&heap[child]),
+                    cursor_name(&heap[smallest])) < 0) {
+                smallest = child;
+            }
+        }
+        if (smallest == parent) {
+            return;
+        }
+        Cursor swap = heap[parent];
+        heap[parent] = heap[smallest];
+        heap[smallest] = swap;
+        parent = smallest;
+    }
+}
+
+/**
+ * Allocates memory from the given arena, starting a new chunk if the current
+ * one has too little room left.
+ * @param arena - the arena to allocate from.
+ * @param size - the number of bytes to allocate.
+ * @param alignment - the alignment of the allocation; a power of two.
+ * @return - the allocated memory.
+ */
+void* arena_allocate(Arena* arena, size_t size, size_t alignment) {
+    size_t padding = -(uintptr_t)arena->next & (alignment - 1);
+    if (padding + size > arena->remaining) {
+        size_t chunkSize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        arena->next = malloc(chunkSize);
+        arena->remaining = chunkSize;
+        padding = 0;
+    }
+    void* memory = arena->next + padding;
+    arena->next += padding + size;
+    arena->remaining -= padding + size;
+    return memory;
+}
+
+/**
+ * Allocates memory from the given arena which may later be handed back with
+ * arena_recycle, reusing memory recycled from an earlier allocation of the
+ * same size if there is any.
+ * @param arena - the arena to allocate from.
+ * @param size - the number of bytes to allocate; at most ARENA_MAX_RECYCLED.
+ * @return - the allocated memory, aligned to ARENA_GRANULE.
+ */
+void* arena_allocate_recyclable(Arena* arena, size_t size) {
+    size_t granules = (size + ARENA_GRANULE - 1) / ARENA_GRANULE;
+    void* memory = arena->freeLists[granules];
+    if (memory) {
+        arena->freeLists[granules] = *(void**)memory;
+        return memory;
+    }
+    return arena_allocate(arena, granules * ARENA_GRANULE, ARENA_GRANULE);
+}
+
+/**
+ * Hands memory allocated by arena_allocate_recyclable back to the given
+ * arena, to be reused by a later allocation of the same size.
+ * @param arena - the arena the memory was allocated from.
+ * @param memory - the memory to recycle.
+ * @param size - the size the memory was allocated with.
+ */
+void arena_recycle(Arena* arena, void* memory, size_t size) {
+    size_t granules = (size + ARENA_GRANULE - 1) / ARENA_GRANULE;
+    *(void**)memory = arena->freeLists[granules];
+    arena->freeLists[granules] = memory;
+}
+
+/**
+ * Appends an airport record to the given pool of records, which is grown as
+ * needed; records are padded to keep them aligned. Since the pool may move
+ * as it grows, records are addressed by their offsets until it is complete.
+ * @param pool - the pool to append to.
+ * @param airportName - the ID of the airport (need not be null terminated).
+ * @param nameLength - the number of chars in the ID.
+ * @param portNumber - the port number of the airport.
+ * @return - the offset of the record within the pool.
+ */
+size_t pool_airport(Buffer* pool, const char* airportName, size_t nameLength,
+        uint16_t portNumber) {
+    size_t offset = (pool->length + _Alignof(Airport) - 1) &
+            ~(_Alignof(Airport) - 1);
+    size_t size = AIRPORT_SIZE(nameLength);
+    if (offset + size > pool->capacity) {
+        pool->capacity = pool->capacity ? 2 * pool->capacity : 64 * 1024;
+        if (pool->capacity < offset + size) {
+            pool->capacity = offset + size;
+        }
+        pool->data = realloc(pool->data, pool->capacity);
+    }
+    Airport* airport = (Airport*)(pool->data + offset);
+    airport->lease = NULL;
+    atomic_init(&airport->nextEndpoint, NULL);
+    airport->portNumber = portNumber;
+    airport->size = 0;
+    atomic_init(&airport->load, 0);
+    atomic_init(&airport->turn, 0);
+    memcpy(airport->name, airportName, nameLength);
+    airport->name[nameLength] = 0;
+    pool->length = offset + size;
+    return offset;
+}
+
+/**
+ * Converts a port number given as text to an integer.
+ * @param portNumber - the text to convert.
+ * @return - the port number, or 0 if the text is not an integer from 1 to
+ * 65535.
+ */
+uint16_t parse_port_number(char* portNumber) {
+    if (!is_integer(portNumber) || strlen(portNumber) > MAX_PORT_CHARS ||
+            atoi(portNumber) > UINT16_MAX) {
+        return 0;
+    }
+    return atoi(portNumber);
+}
+
+/**
+ * Writes the given port number as text (not null terminated).
+ * @param portNumber - the port number to write.
+ * @param output - where to write the text; must have room for
+ * MAX_PORT_CHARS chars.
+ * @return - the number of chars written.
+ */
+size_t format_port_number(uint16_t portNumber, char* output) {
+    char digits[MAX_PORT_CHARS];
+    size_t length = 0;
+    do {
+        digits[length++] = '0' + portNumber % 10;
+        portNumber /= 10;
+    } while (portNumber);
+    for (size_t i = 0; i < length; i++) {
+        output[i] = digits[length - 1 - i];
     }
-    // insert airport into this index
-    airports[insertionIndex] = airport;
-    (*numAirports)++;
+    return length;
 }
 
 /**
@@ -278,7 +4548,7 @@ void add_airport(char command[], Airport** airports, int* numAirports) {
  * @return - 1 if the given string is valid, else 0.
  */
 int is_integer(char* string) {
-    for (int i = 0; i < strlen(string); i++) {
+    for (size_t i = 0; i < strlen(string); i++) {
         if (!isdigit(string[i])) {
             return 0;
         }
@@ -4,13 +4,68 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <zconf.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The header of a mapper's shared memory segment, which holds a read-only
+ * copy of its registry, as laid out by mapper2310. The header is followed by
+ * a hash table of capacity slots, then by stringsCapacity chars of null
+ * terminated IDs and port numbers. The sequence is odd while the mapper
+ * changes the segment. The mapper's process ID and start time identify the
+ * mapper, so that the segment of one which died can be ignored */
+typedef struct {
+    char magic[8];
+    _Atomic uint64_t sequence;
+    uint64_t processID;
+    uint64_t startTime;
+    uint64_t capacity;
+    uint64_t stringsCapacity;
+    uint64_t stringsLength;
+    uint64_t numFilled;
+    uint64_t numAirports;
+} SharedHeader;
+
+/* A slot of a mapper's shared hash table: the hash of an airport's ID, and
+ * the offsets of its ID (0 if the slot is empty, SHARED_REMOVED if it was
+ * removed) and port number among the strings */
+typedef struct {
+    uint64_t hash;
+    uint32_t name;
+    uint32_t portNumber;
+} SharedSlot;
+
+/* A mapper's shared memory segment, as mapped by this roc */
+typedef struct {
+    int fileDescriptor;
+    SharedHeader* header;
+    size_t size;
+} SharedSegment;
 
 char** create_log(char** ports, int numPorts, char* id, int* logSize,
         int* failedConnection);
 void display_log(char** log, int logSize);
-int connect_to_port(char* port);
-int parse_to_port_numbers(char** airports, int numAirports, char* mapper);
+int connect_to_port(char* port, int type);
+int parse_to_port_numbers(char** airports, int numAirports, char* mapper,
+        int useDatagrams, int waitTime);
+int wait_for_port_numbers(char** airports, int* missing, int numMissing,
+        char* mapper, int waitTime);
+int parse_from_shared_memory(char** airports, int numAirports, char* mapper);
+char* find_in_shared_memory(SharedSegment* segment, char* airportName);
+int map_shared_segment(SharedSegment* segment, size_t size);
+uint64_t hash_id(const char* airportName);
+uint64_t get_start_time(pid_t processID);
+int request_by_connection(int fileDescriptor, char** batches, int numBatches,
+        char** replies);
+int request_by_datagram(int fileDescriptor, char** batches, int numBatches,
+        char** replies);
 char* read_line(FILE* stream);
+char* read_long_line(FILE* stream);
 int is_valid_port_number(char* port);
 int verify_port_numbers(char** ports, int numPorts);
 int verify_message(char* string);
@@ -20,10 +75,59 @@ int is_integer(char* string);
  * communications */
 #define MAX_CHARS 79
 
+/* The maximum permitted size of a batched lookup message sent to the mapper */
+#define MAX_BATCH_CHARS 4095
+
+/* The maximum size of a reply datagram from the mapper */
+#define MAX_DATAGRAM_CHARS 65507
+
+/* The number of milliseconds to wait for the mapper to answer a lookup
+ * datagram, and the number of times to send it before giving up */
+#define DATAGRAM_TIMEOUT 500
+#define DATAGRAM_ATTEMPTS 3
+
+/* The maximum number of milliseconds to wait for airports to be registered */
+#define MAX_WAIT_TIME 9999999
+
+/* The number of milliseconds, beyond the end of a wait, to allow for the
+ * mapper's answer to arrive before giving up on it */
+#define WAIT_SLACK 500
+
+/* The identifying bytes at the start of a mapper's shared memory segment, and
+ * the segment's name given the mapper's port number */
+#define SHARED_MAGIC "MAPSHM2"
+#define SHARED_NAME_FORMAT "/mapper2310-%d"
+
+/* The name offset which marks a shared slot whose airport was removed */
+#define SHARED_REMOVED UINT32_MAX
+
+/* The number of times to try reading a shared memory segment while the
+ * mapper keeps changing it, before asking the mapper instead */
+#define SHARED_ATTEMPTS 1000
+
 int main(int argc, char** argv) {
     /* Verify args */
-    if (argc < 3) {
-        fprintf(stderr, "Usage: roc2310 id mapper {airports}\n");
+    int useDatagrams = 0;
+    int waitTime = 0;
+    int validOptions = 1;
+    while (argc > 1 && validOptions && (strcmp(argv[1], "-u") == 0 ||
+            strcmp(argv[1], "-w") == 0)) {
+        if (strcmp(argv[1], "-u") == 0) {
+            useDatagrams = 1; // look airports up over UDP
+        } else if (argc > 2 && is_integer(argv[2]) &&
+                strlen(argv[2]) <= 7 && atoi(argv[2]) <= MAX_WAIT_TIME) {
+            waitTime = atoi(argv[2]); // wait for unregistered airports
+            argv++;
+            argc--;
+        } else {
+            validOptions = 0;
+        }
+        argv++;
+        argc--;
+    }
+    if (argc < 3 || !validOptions) {
+        fprintf(stderr, "Usage: roc2310 [-u] [-w timeout] id mapper "
+                "{airports}\n");
         exit(1);
     }
     char* id = argv[1];
@@ -46,7 +150,8 @@ int main(int argc, char** argv) {
             exit(3);
         }
     } else {
-        int result = parse_to_port_numbers(airports, numAirports, mapper);
+        int result = parse_to_port_numbers(airports, numAirports, mapper,
+                useDatagrams, waitTime);
         if (result == -1) {
             fprintf(stderr, "Failed to connect to mapper\n");
             fflush(stderr);
@@ -93,7 +198,7 @@ char** create_log(char** ports, int numPorts, char* id, int* logSize,
     *logSize = 0;
     for (int i = 0; i < numPorts; i++) {
         /* Connect to the port */
-        int fileDescriptor = connect_to_port(ports[i]);
+        int fileDescriptor = connect_to_port(ports[i], SOCK_STREAM);
         if (fileDescriptor == -1) {
             *failedConnection = 1; // failed to connect to port
             continue;
@@ -136,22 +241,24 @@ void display_log(char** log, int logSize) {
  * If successful, returns the file descriptor of the connected socket.
  * If unsuccessful, returns -1.
  * @param port - to connect to.
+ * @param type - the type of socket; SOCK_STREAM (TCP) or SOCK_DGRAM (UDP,
+ * for which connecting only fixes the address datagrams are sent to).
  * @return - the file descriptor of the connected socket, or -1 if connection
  * failed.
  */
-int connect_to_port(char* port) {
+int connect_to_port(char* port, int type) {
     /* Retrieve address info of localhost */
     struct addrinfo* addressInfo = 0;
     struct addrinfo hints;
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_INET;          // IPv4
-    hints.ai_socktype = SOCK_STREAM;    // TCP
+    hints.ai_socktype = type;
     if (getaddrinfo("localhost", port, &hints, &addressInfo)) {
         freeaddrinfo(addressInfo);
         return -1;
     }
     /* Create socket, connect to it and return its file descriptor */
-    int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    int fileDescriptor = socket(AF_INET, type, 0);
     if (connect(fileDescriptor, addressInfo->ai_addr,
             sizeof(struct sockaddr))) {
         return -1;
@@ -163,41 +270,422 @@ int connect_to_port(char* port) {
  * Takes an array containing a combination of airport IDs and port numbers, and
  * attempts to use the given mapper to convert all airport IDs to their
  * corresponding port number.
- * mapper.
+ * IDs are sent to the mapper in batched lookups ("&ID:ID:..."), each as large
+ * as the mapper permits. Over a connection, every batch is sent before any
+ * reply is read, so resolving the whole list costs a single round trip to the
+ * mapper. Over UDP, each batch is sent as its own datagram and answered by a
+ * single reply datagram, with no connection to set up or tear down.
+ * If the mapper shares its registry in shared memory (see
+ * parse_from_shared_memory), the IDs are read from there instead, and the
+ * mapper is only asked if any of them are not found. IDs the mapper does
+ * not recognise are waited for, if given a time to wait (see
+ * wait_for_port_numbers).
  * @param airports - the combined list of airport IDs and port numbers to
  * parse.
  * @param numAirports - the size of the combined list of IDs and port numbers.
  * @param mapper - the port which the mapper is listening on.
+ * @param useDatagrams - whether to send lookups to the mapper over UDP.
+ * @param waitTime - the number of milliseconds to wait for unrecognised IDs
+ * to be registered, in total.
  * @return - 0 if successful, -1 if the connection to mapper failed, or -2 if
  * the mapper did not recognise an airport id.
  */
-int parse_to_port_numbers(char** airports, int numAirports, char* mapper) {
+int parse_to_port_numbers(char** airports, int numAirports, char* mapper,
+        int useDatagrams, int waitTime) {
+    if (parse_from_shared_memory(airports, numAirports, mapper) == 0) {
+        return 0;
+    }
     /* Connect to mapper */
-    int fileDescriptor = connect_to_port(mapper);
+    int fileDescriptor = connect_to_port(mapper,
+            useDatagrams ? SOCK_DGRAM : SOCK_STREAM);
     if (fileDescriptor == -1) {
         return -1; // failed connection
     }
-    int fileDescriptorCopy = dup(fileDescriptor);
-    FILE* readStream = fdopen(fileDescriptor, "r");
-    FILE* writeStream = fdopen(fileDescriptorCopy, "w");
-    /* For each airport id, use the mapper to convert to port if required */
+    /* Find the airports which are given as IDs, and so need converting */
+    int pending[numAirports];
+    int numPending = 0;
     for (int i = 0; i < numAirports; i++) {
         if (!is_valid_port_number(airports[i])) {
-            // request port number from mapper for this id
-            fprintf(writeStream, "?%s\n", airports[i]);
-            fflush(writeStream);
-            char* portNumber = read_line(readStream);
-            if (!portNumber || !verify_message(portNumber)) {
-                return -2; // reading error, or invalid text in mapper output
+            size_t len = strlen(airports[i]);
+            if (len < 1 || len > MAX_BATCH_CHARS - 1 ||
+                    strchr(airports[i], ':')) {
+                return -2; // too long to look up, or not a valid id
+            }
+            pending[numPending++] = i;
+        }
+    }
+    if (!numPending) {
+        return 0;
+    }
+    /* Build lookups for every airport id, in as few batches as the mapper's
+     * message size permits */
+    char* batches[numPending];
+    int numBatches = 0;
+    size_t batchLength = 0;
+    for (int i = 0; i < numPending; i++) {
+        char* airport = airports[pending[i]];
+        if (batchLength &&
+                batchLength + 1 + strlen(airport) > MAX_BATCH_CHARS) {
+            batchLength = 0;
+        }
+        if (!batchLength) {
+            batches[numBatches] = malloc(MAX_BATCH_CHARS + 2);
+            batchLength = sprintf(batches[numBatches++], "&%s", airport);
+        } else {
+            batchLength += sprintf(batches[numBatches - 1] + batchLength,
+                    ":%s", airport);
+        }
+    }
+    char* replies[numBatches];
+    int result = useDatagrams ?
+            request_by_datagram(fileDescriptor, batches, numBatches, replies) :
+            request_by_connection(fileDescriptor, batches, numBatches,
+            replies);
+    if (result) {
+        return result;
+    }
+    /* Read each batch's port numbers, which are given in the same order as
+     * the IDs were requested */
+    int numParsed = 0;
+    int missing[numPending];
+    int numMissing = 0;
+    for (int batch = 0; batch < numBatches; batch++) {
+        char* portNumbers = replies[batch];
+        if (!portNumbers || portNumbers[strlen(portNumbers) - 1] != '\n') {
+            return -2; // reading error, or truncated mapper output
+        }
+        portNumbers[strlen(portNumbers) - 1] = 0; // truncate trailing '\n'
+        for (char* portNumber = strtok(portNumbers, ":"); portNumber;
+                portNumber = strtok(NULL, ":")) {
+            if (numParsed == numPending) {
+                return -2; // unexpected output
             }
-            portNumber[strlen(portNumber) - 1] = 0; // truncate trailing '\n'
             if (strcmp(portNumber, ";") == 0) {
-                return -2; // no map entry for airport
+                missing[numMissing++] = pending[numParsed++]; // no map entry
+                continue;
             }
             // assume whatever else mapper returned is a valid port number
-            airports[i] = portNumber;
+            airports[pending[numParsed++]] = portNumber;
         }
     }
+    if (numParsed != numPending) {
+        return -2; // mapper did not return a port number for every airport
+    }
+    if (numMissing && !waitTime) {
+        return -2;
+    }
+    return numMissing ?
+            wait_for_port_numbers(airports, missing, numMissing, mapper,
+            waitTime) : 0;
+}
+
+/**
+ * Asks the mapper, over a new connection, for the port numbers of airports
+ * which were not yet registered, waiting for each of them to be registered
+ * ("?ID:TIMEOUT"). The airports are waited for one at a time, each for as
+ * much of the given time as the earlier ones left, so that the whole wait
+ * lasts no longer than that time (give or take WAIT_SLACK for each answer to
+ * arrive, after which it is given up on).
+ * @param airports - the combined list of airport IDs and port numbers; the
+ * missing IDs are replaced with their port numbers.
+ * @param missing - the positions of the missing IDs within airports.
+ * @param numMissing - the number of missing IDs.
+ * @param mapper - the port which the mapper is listening on.
+ * @param waitTime - the number of milliseconds to wait for, in total.
+ * @return - 0 if successful, -1 if the connection to mapper failed, or -2 if
+ * some airport was not registered in time.
+ */
+int wait_for_port_numbers(char** airports, int* missing, int numMissing,
+        char* mapper, int waitTime) {
+    int fileDescriptor = connect_to_port(mapper, SOCK_STREAM);
+    if (fileDescriptor == -1) {
+        return -1;
+    }
+    int fileDescriptorCopy = dup(fileDescriptor);
+    FILE* readStream = fdopen(fileDescriptor, "r");
+    FILE* writeStream = fdopen(fileDescriptorCopy, "w");
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numMissing; i++) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                (now.tv_nsec - start.tv_nsec) / 1000000;
+        long remaining = elapsed < waitTime ? waitTime - elapsed : 0;
+        fprintf(writeStream, "?%s:%ld\n", airports[missing[i]], remaining);
+        fflush(writeStream);
+        struct pollfd reply = {fileDescriptor, POLLIN, 0};
+        if (poll(&reply, 1, remaining + WAIT_SLACK) != 1) {
+            return -2; // the mapper did not answer in time
+        }
+        char* portNumber = read_line(readStream);
+        if (!portNumber || portNumber[strlen(portNumber) - 1] != '\n' ||
+                strcmp(portNumber, ";\n") == 0) {
+            return -2; // reading error, or still no map entry for airport
+        }
+        portNumber[strlen(portNumber) - 1] = 0; // truncate trailing '\n'
+        airports[missing[i]] = portNumber;
+    }
+    fclose(readStream);
+    fclose(writeStream);
+    return 0;
+}
+
+/**
+ * Attempts to convert every airport ID in the given array to its port number
+ * by reading the shared memory segment of the given mapper (run with -m),
+ * without communicating with the mapper at all. Nothing is converted unless
+ * every ID is found, so the caller can fall back to asking the mapper.
+ * @param airports - the combined list of airport IDs and port numbers to
+ * parse.
+ * @param numAirports - the size of the combined list of IDs and port numbers.
+ * @param mapper - the port which the mapper is listening on.
+ * @return - 0 if every ID was converted, or -1 if the mapper has no segment
+ * (or has exited), or some ID was not found in it.
+ */
+int parse_from_shared_memory(char** airports, int numAirports, char* mapper) {
+    char name[32];
+    sprintf(name, SHARED_NAME_FORMAT, atoi(mapper));
+    SharedSegment segment = {shm_open(name, O_RDONLY, 0), NULL, 0};
+    if (segment.fileDescriptor == -1) {
+        return -1; // the mapper is not sharing its registry
+    }
+    if (map_shared_segment(&segment, sizeof(SharedHeader)) ||
+            memcmp(segment.header->magic, SHARED_MAGIC,
+            sizeof(segment.header->magic)) ||
+            !segment.header->startTime ||
+            get_start_time(segment.header->processID) !=
+            segment.header->startTime) {
+        // not a segment, or left behind by a mapper which has since exited
+        if (segment.header) {
+            munmap(segment.header, segment.size);
+        }
+        close(segment.fileDescriptor);
+        return -1;
+    }
+    char* portNumbers[numAirports];
+    int result = 0;
+    for (int i = 0; i < numAirports && !result; i++) {
+        portNumbers[i] = is_valid_port_number(airports[i]) ? airports[i] :
+                find_in_shared_memory(&segment, airports[i]);
+        if (!portNumbers[i]) {
+            result = -1;
+        }
+    }
+    munmap(segment.header, segment.size);
+    close(segment.fileDescriptor);
+    if (!result) {
+        memcpy(airports, portNumbers, numAirports * sizeof(char*));
+    }
+    return result;
+}
+
+/**
+ * Looks an airport ID up in the given shared memory segment. The mapper
+ * changes the segment under a seqlock, so the lookup copies the port number
+ * out, then starts again if the mapper was changing the segment meanwhile.
+ * Every offset read from the segment is checked against its size, since a
+ * read which overlaps a change may see anything.
+ * @param segment - the mapped segment, which is remapped if the mapper has
+ * grown it.
+ * @param airportName - the ID to look up.
+ * @return - the port number of the airport, or NULL if it is not in the
+ * segment (or the segment could not be read).
+ */
+char* find_in_shared_memory(SharedSegment* segment, char* airportName) {
+    uint64_t hash = hash_id(airportName);
+    size_t nameLength = strlen(airportName);
+    char portNumber[MAX_CHARS + 1];
+    for (int attempt = 0; attempt < SHARED_ATTEMPTS; attempt++) {
+        SharedHeader* header = segment->header;
+        uint64_t sequence = atomic_load_explicit(&header->sequence,
+                memory_order_acquire);
+        if (sequence % 2) {
+            sched_yield(); // the mapper is changing the segment
+            continue;
+        }
+        uint64_t capacity = header->capacity;
+        uint64_t stringsCapacity = header->stringsCapacity;
+        size_t size = sizeof(SharedHeader) + capacity * sizeof(SharedSlot) +
+                stringsCapacity;
+        if (capacity & (capacity - 1) || capacity > SIZE_MAX /
+                sizeof(SharedSlot) || stringsCapacity > UINT32_MAX) {
+            continue; // read during a change
+        }
+        if (size > segment->size) {
+            if (map_shared_segment(segment, size)) {
+                return NULL;
+            }
+            continue; // the mapper grew the segment; start again
+        }
+        SharedSlot* slots = (SharedSlot*)(header + 1);
+        char* strings = (char*)(slots + capacity);
+        int found = 0;
+        size_t mask = capacity - 1;
+        for (size_t slot = hash & mask, probes = 0;
+                capacity && slots[slot].name && probes < capacity;
+                slot = (slot + 1) & mask, probes++) {
+            uint32_t name = slots[slot].name;
+            uint32_t port = slots[slot].portNumber;
+            if (name == SHARED_REMOVED || slots[slot].hash != hash ||
+                    name >= stringsCapacity ||
+                    stringsCapacity - name <= nameLength ||
+                    memcmp(strings + name, airportName, nameLength + 1)) {
+                continue;
+            }
+            if (port < stringsCapacity) {
+                size_t length = strnlen(strings + port,
+                        stringsCapacity - port);
+                if (length <= MAX_CHARS) {
+                    memcpy(portNumber, strings + port, length);
+                    portNumber[length] = 0;
+                    found = 1;
+                }
+            }
+            break;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&header->sequence, memory_order_relaxed) !=
+                sequence) {
+            continue; // the mapper changed the segment during the lookup
+        }
+        return found && is_valid_port_number(portNumber) ?
+                strdup(portNumber) : NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Maps (or remaps) the given shared memory segment, read only, if it is at
+ * least the given size.
+ * @param segment - the segment to map, with its file descriptor set.
+ * @param size - the number of bytes which must be mapped.
+ * @return - 0 if successful, or -1 if the segment is smaller than the given
+ * size or could not be mapped.
+ */
+int map_shared_segment(SharedSegment* segment, size_t size) {
+    struct stat status;
+    if (fstat(segment->fileDescriptor, &status) ||
+            (size_t)status.st_size < size) {
+        return -1;
+    }
+    void* mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED,
+            segment->fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    if (segment->header) {
+        munmap(segment->header, segment->size);
+    }
+    segment->header = mapping;
+    segment->size = status.st_size;
+    return 0;
+}
+
+/**
+ * Hashes an airport ID in the same way as the mapper (64-bit FNV-1a), to
+ * find it in the mapper's shared hash table.
+ * @param airportName - the ID to hash.
+ * @return - the hash.
+ */
+uint64_t hash_id(const char* airportName) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* c = airportName; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Reads the time the given process started at, in clock ticks since the host
+ * booted, from /proc, in the same way as the mapper.
+ * @param processID - the process to read the start time of.
+ * @return - the start time, or 0 if it could not be read (such as when there
+ * is no such process).
+ */
+uint64_t get_start_time(pid_t processID) {
+    char path[32];
+    sprintf(path, "/proc/%d/stat", (int)processID);
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    char status[1024];
+    size_t length = fread(status, 1, sizeof(status) - 1, file);
+    fclose(file);
+    status[length] = 0;
+    /* The start time is the 22nd field, counted from the end of the
+     * parenthesised process name */
+    char* field = strrchr(status, ')');
+    for (int i = 2; field && i < 22; i++) {
+        field = strchr(field + 1, ' ');
+    }
+    return field ? strtoull(field + 1, NULL, 10) : 0;
+}
+
+/**
+ * Sends every given lookup to the mapper over a connection, then reads back
+ * the reply to each of them.
+ * @param fileDescriptor - the socket connected to the mapper.
+ * @param batches - the lookups to send, without trailing newlines.
+ * @param numBatches - the number of lookups.
+ * @param replies - set to the reply line to each lookup (including its
+ * newline), or NULL if it could not be read.
+ * @return - 0, since a reply which could not be read is left NULL.
+ */
+int request_by_connection(int fileDescriptor, char** batches, int numBatches,
+        char** replies) {
+    int fileDescriptorCopy = dup(fileDescriptor);
+    FILE* readStream = fdopen(fileDescriptor, "r");
+    FILE* writeStream = fdopen(fileDescriptorCopy, "w");
+    for (int batch = 0; batch < numBatches; batch++) {
+        fprintf(writeStream, "%s\n", batches[batch]);
+    }
+    fflush(writeStream);
+    for (int batch = 0; batch < numBatches; batch++) {
+        replies[batch] = read_long_line(readStream);
+    }
+    return 0;
+}
+
+/**
+ * Sends each given lookup to the mapper as a datagram, and waits for its
+ * reply datagram before sending the next. A lookup which is not answered
+ * within DATAGRAM_TIMEOUT milliseconds is sent again, up to
+ * DATAGRAM_ATTEMPTS times in all. Any stray datagrams (such as late replies
+ * to an earlier attempt) are discarded before each lookup is sent.
+ * @param fileDescriptor - the UDP socket connected to the mapper.
+ * @param batches - the lookups to send.
+ * @param numBatches - the number of lookups.
+ * @param replies - set to the reply to each lookup (including its newline).
+ * @return - 0 if every lookup was answered, else -1.
+ */
+int request_by_datagram(int fileDescriptor, char** batches, int numBatches,
+        char** replies) {
+    char discarded[1];
+    for (int batch = 0; batch < numBatches; batch++) {
+        while (recv(fileDescriptor, discarded, 1, MSG_DONTWAIT) != -1) {
+        }
+        replies[batch] = malloc(MAX_DATAGRAM_CHARS + 1);
+        ssize_t received = -1;
+        for (int attempt = 0; attempt < DATAGRAM_ATTEMPTS && received == -1;
+                attempt++) {
+            if (send(fileDescriptor, batches[batch], strlen(batches[batch]),
+                    0) == -1) {
+                return -1; // e.g. the mapper is not answering datagrams
+            }
+            struct pollfd reply = {fileDescriptor, POLLIN, 0};
+            if (poll(&reply, 1, DATAGRAM_TIMEOUT) == 1) {
+                received = recv(fileDescriptor, replies[batch],
+                        MAX_DATAGRAM_CHARS, 0);
+            }
+        }
+        if (received == -1) {
+            return -1; // no reply from the mapper
+        }
+        replies[batch][received] = 0;
+    }
     return 0;
 }
 
@@ -214,6 +702,21 @@ char* read_line(FILE* stream) {
     return fgets(buffer, bufferSize, stream);
 }
 
+/**
+ * Reads a line of input of any length from the specified stream.
+ * @param stream - from which to read the line of input.
+ * @return - a null-terminated string, or NULL if a reading error occurred.
+ */
+char* read_long_line(FILE* stream) {
+    char* buffer = NULL;
+    size_t bufferSize = 0;
+    if (getline(&buffer, &bufferSize, stream) == -1) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
 /**
  * Verifies whether the given string represents a valid port number.
  * Valid port numbers are defined as integers between 1 and 65535 inclusive.
@@ -263,7 +766,7 @@ int verify_message(char* string) {
     if (string[len - 1] != '\n') {
         return 0; // text is not newline terminated
     }
-    for (int i = 0; i < len - 1; i++) {
+    for (size_t i = 0; i < len - 1; i++) {
         if (string[i] == '\n' || string[i] == '\r' || string[i] == ':') {
             return 0; // text contains invalid chars
         }
@@ -277,7 +780,7 @@ int verify_message(char* string) {
  * @return - 1 if the given string is valid, else 0.
  */
 int is_integer(char* string) {
-    int i;
+    size_t i;
     for (i = 0; i < strlen(string); i++) {
         if (!isdigit(string[i])) {
             return 0;
@@ -0,0 +1,61 @@
+"""Helpers shared by the tests and benchmarks: start the programs, talk to
+them over connections, and report failures."""
+import os
+import socket
+import subprocess
+import sys
+
+# Directory holding the built programs (the repository root by default)
+BIN_DIR = os.environ.get('BIN_DIR',
+        os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+processes = []
+
+
+def start(program, *args):
+    """Starts a program, and returns it with the port number it prints."""
+    process = subprocess.Popen([os.path.join(BIN_DIR, program)] + list(args),
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    processes.append(process)
+    return process, process.stdout.readline().strip()
+
+
+def connect(port):
+    """Connects to a port, returning the socket and a file over it."""
+    connection = socket.create_connection(('localhost', int(port)))
+    return connection, connection.makefile('rw')
+
+
+def ask(file, message, numLines=1):
+    """Sends a message and returns the given number of reply lines."""
+    file.write(message + '\n')
+    file.flush()
+    return [file.readline().rstrip('\n') for _ in range(numLines)]
+
+
+def read_until(file, terminators):
+    """Reads reply lines up to and including one that starts with any of the
+    given terminators, returning them all."""
+    lines = []
+    while True:
+        line = file.readline().rstrip('\n')
+        lines.append(line)
+        if not line or line.startswith(terminators):
+            return lines
+
+
+def stop_all():
+    """Terminates every program started so far, letting them clean up (such
+    as the mapper removing its shared memory segment)."""
+    for process in processes:
+        process.terminate()
+        process.wait()
+    processes.clear()
+
+
+def check(condition, message):
+    """Fails the test with the given message unless the condition holds."""
+    if not condition:
+        print('FAIL:', message)
+        stop_all()
+        sys.exit(1)
@@ -0,0 +1,42 @@
+"""Checks registering many IDs with a single "!" message, and loading
+registrations from a file on start-up (-l)."""
+import os
+import subprocess
+import tempfile
+from common import *
+
+mapper, port = start('mapper2310')
+connection, file = connect(port)
+# As many pairs as fit in one message, in shuffled order
+pairs = ['b%03d:%d' % (i, 2000 + i) for i in range(280)]
+message = '!' + ':'.join(pairs[i * 97 % 280] for i in range(280))
+check(len(message) <= 4095, 'message too long for the test')
+file.write(message + '\n')
+file.flush()
+check(ask(file, '@', 280) == pairs, 'bulk registration')
+# Invalid pairs are skipped without affecting the rest
+file.write('!c:0:d:1:e:2000:f:65536:g:3:h\n')
+file.flush()
+check(ask(file, '&c:d:e:f:g:h') == [';:1:;:;:3:;'], 'invalid pairs skipped')
+stop_all()
+
+# A registrations file, with the same quirks as "!"
+directory = tempfile.mkdtemp()
+registrations = os.path.join(directory, 'registrations')
+with open(registrations, 'w') as registrationsFile:
+    registrationsFile.write('zed:1234\nalpha:99\nalpha:98\nnoport\nbad:0\n'
+            'taken:99\n%s:5\nlast:7' % ('x' * 4096))
+mapper, port = start('mapper2310', '-l', registrations)
+connection, file = connect(port)
+check(ask(file, '@', 4) == ['alpha:99', 'alpha:98', 'last:7', 'zed:1234'],
+        'registrations loaded')
+check(ask(file, '!more:8:zed:9\n@', 6) == ['alpha:99', 'alpha:98', 'last:7',
+        'more:8', 'zed:1234', 'zed:9'], 'registered after loading')
+stop_all()
+
+result = subprocess.run([os.path.join(BIN_DIR, 'mapper2310'), '-l',
+        os.path.join(directory, 'missing')], capture_output=True, text=True)
+check(result.returncode == 2 and
+        result.stderr == 'Invalid registrations file\n',
+        'missing registrations file')
+print('bulk ok')
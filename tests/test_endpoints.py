@@ -0,0 +1,61 @@
+"""Checks IDs registered with several port numbers (endpoints): lookups
+choose the least loaded endpoint (as reported with "*"), taking turns between
+equals, and controls sharing an ID report their loads."""
+import collections
+import time
+from common import *
+
+
+def look_up(file, airportName, count):
+    """Looks an ID up the given number of times, counting each answer."""
+    return collections.Counter(ask(file, '\n'.join(['?' + airportName] *
+            count), count))
+
+
+mapper, port = start('mapper2310', '-s', '4')
+connection, file = connect(port)
+file.write('!a:1:a:2:a:3\n!a:2\n')
+check(ask(file, '@', 3) == ['a:1', 'a:2', 'a:3'], 'endpoints listed')
+check(look_up(file, 'a', 300) == {'1': 100, '2': 100, '3': 100},
+        'turns taken between unreported loads')
+# The least loaded endpoint is chosen, and equally loaded ones take turns
+file.write('*a:1:5\n*a:2:5\n*a:3:2\n')
+check(look_up(file, 'a', 30) == {'3': 30}, 'least loaded chosen')
+file.write('*a:3:5\n')
+check(look_up(file, 'a', 30) == {'1': 10, '2': 10, '3': 10},
+        'turns taken between equal loads')
+# Loads beyond 65535 count as 65535, and invalid reports are ignored
+file.write('*a:2:999999\n*a:9:0\n*a:1:x\n*nope:1:1\n')
+check(set(look_up(file, 'a', 20)) == {'1', '3'}, 'load reports checked')
+# Removing endpoints keeps the loads of the rest
+file.write('-a:1\n')
+check(ask(file, '@', 2) == ['a:2', 'a:3'], 'first endpoint removed')
+check(look_up(file, 'a', 10) == {'3': 10}, 'loads kept')
+check(ask(file, '!a:4\n-a\n?a') == [';'], 'every endpoint removed')
+
+# At most 64 endpoints per ID
+file.write('!' + ':'.join('cap:%d' % (100 + i) for i in range(70)) + '\n')
+check(ask(file, '@', 64) == ['cap:%d' % (100 + i) for i in range(64)],
+        'endpoints capped')
+check(ask(file, '?cap:0\n#164', 2)[1] == ';', 'endpoint past the cap ignored')
+file.write('-cap:100\n!cap:999\n')
+check(ask(file, '@', 64)[-1] == 'cap:999', 'room after a removal')
+stop_all()
+
+# Controls sharing an ID report how many planes are connected to each
+mapper, port = start('mapper2310')
+busy, busyPort = start('control2310', 'shared', 'busy', port)
+idle, idlePort = start('control2310', 'shared', 'idle', port)
+time.sleep(0.3)
+connection, file = connect(port)
+planes = [connect(busyPort) for i in range(3)]
+time.sleep(2.5)
+check(look_up(file, 'shared', 10) == {idlePort: 10}, 'idle control chosen')
+for plane, planeFile in planes:
+    planeFile.close()
+    plane.close()
+time.sleep(2.5)
+check(look_up(file, 'shared', 10) == {busyPort: 5, idlePort: 5},
+        'turns taken once both are idle')
+stop_all()
+print('endpoints ok')
@@ -0,0 +1,57 @@
+"""Checks lookups in a registry frozen with -p, of every size from empty up,
+and that a frozen registry ignores registrations and deregistrations."""
+import os
+import subprocess
+import tempfile
+import time
+from common import *
+
+
+def run_mapper(*args):
+    return subprocess.run([os.path.join(BIN_DIR, 'mapper2310')] + list(args),
+            capture_output=True, text=True)
+
+
+directory = tempfile.mkdtemp()
+registrations = os.path.join(directory, 'registrations')
+for count in [0, 1, 2, 5, 1000, 60000]:
+    with open(registrations, 'w') as registrationsFile:
+        registrationsFile.write(''.join('f%d:%d\n' % (i, 1 + i)
+                for i in range(count)))
+        if count:
+            registrationsFile.write('f0:65000\n')  # a second endpoint
+    mapper, port = start('mapper2310', '-p', '-l', registrations)
+    connection, file = connect(port)
+    for i in range(1, count, max(1, count // 2000)):
+        check(ask(file, '?f%d' % i) == [str(1 + i)],
+                'lookup of %d of %d' % (i, count))
+    check(ask(file, '?f%d\n?nothing' % count, 2) == [';', ';'],
+            'missing ids among %d' % count)
+    if count:
+        # The endpoints of an id are still chosen between by load
+        file.write('*f0:1:5\n*f0:65000:2\n')
+        check(ask(file, '?f0\n#65000', 2) == ['65000', 'f0'],
+                'endpoints of a frozen id')
+    if count > 3:
+        check(ask(file, '&f1:nothing:f3') == ['2:;:4'], 'batched lookup')
+    check(ask(file, '!new:65001\n-f1\n?new\n?f1', 2) ==
+            [';', '2' if count > 1 else ';'],
+            'registration and deregistration ignored')
+    stop_all()
+
+# Freezing a registry restored from a snapshot
+snapshot = os.path.join(directory, 'snapshot')
+mapper, port = start('mapper2310', '-l', registrations, '-f', snapshot)
+time.sleep(1.5)
+stop_all()
+mapper, port = start('mapper2310', '-p', '-f', snapshot)
+connection, file = connect(port)
+check(ask(file, '?f59999') == ['60000'], 'frozen from a snapshot')
+stop_all()
+
+for options in [[], ['-l', registrations, '-j', os.path.join(directory, 'j')],
+        ['-l', registrations, '-t', '5']]:
+    result = run_mapper('-p', *options)
+    check(result.returncode == 1 and 'Usage: mapper2310' in result.stderr,
+            'usage of -p with %r' % options)
+print('frozen ok')
@@ -0,0 +1,44 @@
+"""Checks that a mapper run with a journal (-j) acknowledges registrations
+only once they are journalled, and replays them after being killed, dropping
+a record torn by the crash."""
+import os
+import signal
+import tempfile
+import time
+from common import *
+
+journal = os.path.join(tempfile.mkdtemp(), 'journal')
+
+mapper, port = start('mapper2310', '-j', journal)
+connection, file = connect(port)
+check(ask(file, '!a:1\n?a') == ['1'], 'registration acknowledged')
+file.write('!b:2:c:3\n!a:7\n-c\n?b\n&a:c\n')
+file.flush()
+check([file.readline().strip() for _ in range(2)] == ['2', '1:;'],
+        'commands answered in order')
+check(open(journal).read() == '!a:1\n!b:2:c:3\n!a:7\n-c\n',
+        'journal contents %r' % open(journal).read())
+# A registration from a client which closes at once, as controls do
+client, clientFile = connect(port)
+clientFile.write('!d:4\n')
+clientFile.flush()
+client.close()
+time.sleep(0.2)
+
+# Kill the mapper, leaving a partly written record behind as a crash might
+mapper.send_signal(signal.SIGKILL)
+mapper.wait()
+with open(journal, 'a') as journalFile:
+    journalFile.write('!torn:9')
+mapper, port = start('mapper2310', '-j', journal)
+connection, file = connect(port)
+check(ask(file, '@', 4) == ['a:1', 'a:7', 'b:2', 'd:4'], 'replayed')
+check(ask(file, '?torn') == [';'], 'torn record dropped')
+check(open(journal).read().endswith('-c\n!d:4\n'), 'torn record truncated')
+
+# Registrations which change nothing are not journalled
+length = os.path.getsize(journal)
+check(ask(file, '!a:1\n!b:0\n!e:2\n?a') == ['1'], 'no-op registrations')
+check(os.path.getsize(journal) == length, 'no-op registrations journalled')
+stop_all()
+print('journal ok')
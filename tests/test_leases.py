@@ -0,0 +1,45 @@
+"""Checks that registrations leased by a mapper run with -t expire unless
+renewed, that controls keep theirs renewed, and deregistration ("-")."""
+import os
+import subprocess
+import time
+from common import *
+
+result = subprocess.run([os.path.join(BIN_DIR, 'mapper2310'), '-t', '1'],
+        capture_output=True)
+check(result.returncode == 1, 'lease time too short to renew accepted')
+
+mapper, port = start('mapper2310', '-t', '2', '-s', '4')
+connection, file = connect(port)
+check(ask(file, '$') == ['2'], 'lease time')
+file.write('!a:1:b:2:c:3:d:4:d:5\n')
+check(ask(file, '&a:b:c:d') == ['1:2:3:4'], 'registered')
+# Deregister with a port number it does not hold, with the one it does, and
+# without one
+file.write('-a:9\n-b:2\n-c\n-d:4\n')
+check(ask(file, '&a:b:c:d') == ['1:;:;:5'], 'deregistered')
+check(ask(file, '@', 2) == ['a:1', 'd:5'], 'listing')
+
+# A control renews its own registration; "a" is renewed here, and everything
+# else expires
+control, controlPort = start('control2310', 'tower', 'info', port)
+for i in range(8):
+    file.write('!a:1\n')
+    file.flush()
+    time.sleep(0.5)
+check(ask(file, '&a:d:tower') == ['1:;:' + controlPort], 'expired')
+check(ask(file, '@', 2) == ['a:1', 'tower:' + controlPort],
+        'listing after expiry')
+check(ask(file, '#5') == [';'], 'expired port number freed')
+check(ask(file, '!e:5\n?e') == ['5'], 'expired port number reused')
+stop_all()
+
+# Without -t, registrations are not leased, and never expire
+mapper, port = start('mapper2310')
+connection, file = connect(port)
+check(ask(file, '$') == ['0'], 'no lease time')
+check(ask(file, '!a:1\n?a') == ['1'], 'registered without lease')
+time.sleep(2.5)
+check(ask(file, '?a') == ['1'], 'kept without lease')
+stop_all()
+print('leases ok')
@@ -0,0 +1,48 @@
+"""Fills a single block of the registry with long IDs, so that its listing
+passes 64KiB, and checks every command which lists it (and the snapshot file
+written from it)."""
+import os
+import tempfile
+import time
+from common import *
+
+NUM_AIRPORTS = 128
+ID_CHARS = 600
+
+ids = ['%03d' % i + 'x' * (ID_CHARS - 3) for i in range(NUM_AIRPORTS)]
+lines = ['%s:%d' % (ids[i], 1000 + i) for i in range(NUM_AIRPORTS)]
+snapshot = os.path.join(tempfile.mkdtemp(), 'snapshot')
+
+mapper, port = start('mapper2310', '-s', '1', '-f', snapshot)
+connection, file = connect(port)
+for line in reversed(lines):
+    file.write('!' + line + '\n')
+file.flush()
+check(ask(file, '@', NUM_AIRPORTS) == lines, 'full listing')
+check(ask(file, '^0\n^x', 101) == lines[:100] + ['.'], 'prefix listing')
+check(ask(file, '~010:120', 111) == lines[10:120] + ['.'], 'range listing')
+for pageSize in [1, 7, 100, 127, 128]:
+    listed = []
+    cursor = ''
+    while True:
+        file.write('@%d%s\n' % (pageSize, cursor))
+        file.flush()
+        page = read_until(file, ('>', '.'))
+        listed += page[:-1]
+        if page[-1] == '.':
+            break
+        cursor = ':' + page[-1][1:]
+    check(listed == lines, 'paged listing of %d' % pageSize)
+
+subscriber, subscription = connect(port)
+check(ask(subscription, '%', NUM_AIRPORTS + 1) == lines + ['.'],
+        'subscription listing')
+
+# The snapshot is rewritten within a second, and restored from on start-up
+time.sleep(2)
+stop_all()
+mapper, port = start('mapper2310', '-s', '1', '-f', snapshot)
+connection, file = connect(port)
+check(ask(file, '@', NUM_AIRPORTS) == lines, 'restored listing')
+stop_all()
+print('long ids ok')
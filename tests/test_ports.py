@@ -0,0 +1,92 @@
+"""Checks lookups by port number ("#"), that no two IDs hold the same port
+number, even when registered at once from many connections, and that the
+port numbers of expired, loaded, restored and replayed IDs stay unique."""
+import os
+import random
+import tempfile
+import threading
+import time
+from common import *
+
+
+def register_randomly(port, seed):
+    """Registers and deregisters IDs at random, among 100 port numbers."""
+    connection, file = connect(port)
+    generator = random.Random(seed)
+    for i in range(3000):
+        airportName = 'r%d' % generator.randrange(200)
+        if generator.random() < 0.6:
+            file.write('!%s:%d\n' % (airportName,
+                    1000 + generator.randrange(100)))
+        else:
+            file.write('-%s\n' % airportName)
+    ask(file, '?nothing')
+
+
+mapper, port = start('mapper2310', '-s', '4')
+connection, file = connect(port)
+file.write('!a:5:b:5:a:6\n')
+check(ask(file, '@', 2) == ['a:5', 'a:6'], 'duplicate port number rejected')
+check(ask(file, '#5\n#6\n#7\n#0\n#x\n#70000\n#', 7) ==
+        ['a', 'a', ';', ';', ';', ';', ';'], 'port number lookups')
+check(ask(file, '!c:6\n?c') == [';'], 'port number of an endpoint rejected')
+check(ask(file, '-a:5\n!b:5\n#5\n?a', 2) == ['b', '6'],
+        'port number reused after removal')
+check(ask(file, '-a\n#6') == [';'], 'port numbers freed with their id')
+
+# Registrations from many connections, so IDs in different shards race for
+# the same port numbers
+threads = [threading.Thread(target=register_randomly, args=(port, seed))
+        for seed in range(6)]
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
+file.write('@\n?nothing\n')
+file.flush()
+listing = read_until(file, ';')[:-1]
+ports = [line.split(':')[1] for line in listing if line.startswith('r')]
+check(len(ports) == len(set(ports)), 'port numbers unique')
+for line in listing:
+    airportName, airportPort = line.split(':')
+    check(ask(file, '#' + airportPort) == [airportName],
+            'port number lookup of %s' % line)
+stop_all()
+
+# Expired registrations free their port numbers
+mapper, port = start('mapper2310', '-t', '2')
+connection, file = connect(port)
+check(ask(file, '!e:9\n#9') == ['e'], 'leased')
+time.sleep(2.5)
+check(ask(file, '#9\n!g:9\n#9', 2) == [';', 'g'], 'reused after expiry')
+stop_all()
+
+# Only the first line of a registrations file (-l) with each port number is
+# kept, and port numbers stay unique in snapshots (-f) and journals (-j)
+directory = tempfile.mkdtemp()
+registrations = os.path.join(directory, 'registrations')
+snapshot = os.path.join(directory, 'snapshot')
+with open(registrations, 'w') as registrationsFile:
+    registrationsFile.write('z:7\ny:7\nx:8\nz:8\nw:9\nw:9\n')
+mapper, port = start('mapper2310', '-l', registrations, '-f', snapshot)
+connection, file = connect(port)
+check(ask(file, '@', 3) == ['w:9', 'x:8', 'z:7'], 'first line of each kept')
+time.sleep(1.5)
+stop_all()
+for options in [[], ['-p']]:
+    mapper, port = start('mapper2310', '-f', snapshot, *options)
+    connection, file = connect(port)
+    check(ask(file, '#7\n#8\n#9\n#1', 4) == ['z', 'x', 'w', ';'],
+            'restored %r' % options)
+    check(ask(file, '!v:7\n?v') == [';'], 'still rejected %r' % options)
+    stop_all()
+journal = os.path.join(directory, 'journal')
+mapper, port = start('mapper2310', '-j', journal)
+connection, file = connect(port)
+check(ask(file, '!p:3\n!q:3\n-p\n!q:3\n?q') == ['3'], 'journalled')
+stop_all()
+mapper, port = start('mapper2310', '-j', journal)
+connection, file = connect(port)
+check(ask(file, '@\n#3', 2) == ['q:3', 'q'], 'replayed')
+stop_all()
+print('ports ok')
@@ -0,0 +1,72 @@
+"""Checks that rocs read IDs from the shared memory segment of a mapper run
+with -m, without contacting it, and that the segment does not outlive the
+mapper."""
+import os
+import signal
+import subprocess
+import tempfile
+import time
+from common import *
+
+
+def run_roc(*args):
+    return subprocess.run([os.path.join(BIN_DIR, 'roc2310')] + list(args),
+            capture_output=True, text=True, timeout=20)
+
+
+registrations = os.path.join(tempfile.mkdtemp(), 'registrations')
+with open(registrations, 'w') as registrationsFile:
+    registrationsFile.write(''.join('pre%d:%d\n' % (i, 20000 + i)
+            for i in range(3000)))
+
+for options in [[], ['-s', '1'], ['-t', '60']]:
+    mapper, port = start('mapper2310', '-m', '-l', registrations, *options)
+    segment = '/dev/shm/mapper2310-' + port
+    check(os.path.exists(segment), 'segment created')
+    control, controlPort = start('control2310', 'sydney', 'sunny', port)
+    time.sleep(0.3)
+    # A stopped mapper cannot answer, so rocs must use the segment.
+    # Preloaded ids are found too (but have no controls to visit)
+    mapper.send_signal(signal.SIGSTOP)
+    result = run_roc('F1', port, 'sydney', controlPort, 'sydney')
+    preloaded = run_roc('F1', port, 'pre7', 'pre2999')
+    mapper.send_signal(signal.SIGCONT)
+    check(result.returncode == 0 and result.stdout == 'sunny\n' * 3,
+            'roc via shared memory %r' % result.stderr)
+    check(preloaded.returncode == 6, 'preloaded ids via shared memory')
+
+    # Enough registrations to grow the segment (with port numbers below the
+    # range controls are given), then removals
+    connection, file = connect(port)
+    file.write('!' + ':'.join('bulk%d:%d' % (i, 30000 + i)
+            for i in range(200)) + '\n')
+    for i in range(10000):
+        file.write('!more%d:%d\n' % (i, 1000 + i))
+    check(ask(file, '-pre5\n-sydney\n?more9999') == ['10999'], 'registered')
+    other, otherPort = start('control2310', 'fresh', 'seven', port)
+    time.sleep(0.3)
+    mapper.send_signal(signal.SIGSTOP)
+    result = run_roc('F1', port, 'fresh', 'more123')
+    mapper.send_signal(signal.SIGCONT)
+    check(result.returncode == 6 and result.stdout == 'seven\n',
+            'new ids via shared memory %r' % result.stderr)
+    # Removed ids, and those with several endpoints, are left to the mapper
+    file.write('!more123:123\n')
+    result = run_roc('F1', port, 'pre5')
+    check(result.returncode == 5, 'removed id via the mapper')
+    result = run_roc('F1', port, 'more123', 'sydney')
+    check(result.returncode == 5, 'id with several endpoints via the mapper')
+    stop_all()
+    check(not os.path.exists(segment), 'segment removed on SIGTERM')
+
+# The segment of a mapper which was killed is ignored, and replaced by the
+# next mapper on the same port
+mapper, port = start('mapper2310', '-m')
+connection, file = connect(port)
+check(ask(file, '!a:5\n?a') == ['5'], 'registered')
+mapper.send_signal(signal.SIGKILL)
+mapper.wait()
+result = run_roc('F1', port, 'a')
+check(result.returncode == 4, 'segment of a killed mapper ignored')
+os.unlink('/dev/shm/mapper2310-' + port)
+print('shared memory ok')
@@ -0,0 +1,63 @@
+"""Checks lookups over UDP (-u), by single datagrams and through roc -u, with
+one UDP socket shared by every event loop and with one each (-r)."""
+import os
+import socket
+import subprocess
+import time
+from common import *
+
+
+def run_roc(*args):
+    return subprocess.run([os.path.join(BIN_DIR, 'roc2310')] + list(args),
+            capture_output=True, text=True, timeout=20)
+
+
+for options in [[], ['-r']]:
+    mapper, port = start('mapper2310', '-u', *options)
+    connection, file = connect(port)
+    check(ask(file, '!brisbane:5001:perth:5002\n?perth') == ['5002'],
+            'registered')
+    client = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    client.settimeout(2)
+    client.connect(('localhost', int(port)))
+    client.send(b'?perth')
+    check(client.recv(100) == b'5002\n', 'lookup')
+    client.send(b'&perth:nowhere:brisbane\n')
+    check(client.recv(100) == b'5002:;:5001\n', 'batched lookup')
+    client.send(b'#5001')
+    check(client.recv(100) == b'brisbane\n', 'port number lookup')
+    # Anything but a lookup is ignored, and registers nothing
+    for message in [b'!x:1', b'-perth', b'@', b'?', b'%', b'$']:
+        client.send(message)
+    client.send(b'?x')
+    check(client.recv(100) == b';\n', 'other datagrams ignored')
+    check(ask(file, '?perth') == ['5002'], 'no deregistration over UDP')
+    # Many clients, each with several lookups in flight
+    clients = []
+    for i in range(50):
+        other = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        other.settimeout(2)
+        other.connect(('localhost', int(port)))
+        for j in range(4):
+            other.send(b'?brisbane')
+        clients.append(other)
+    check(all(other.recv(100) == b'5001\n' for other in clients
+            for j in range(4)), 'concurrent lookups')
+
+    control, controlPort = start('control2310', 'sydney', 'sunny', port)
+    time.sleep(0.2)
+    result = run_roc('-u', 'F1', port, 'sydney', controlPort, 'sydney')
+    check(result.returncode == 0 and result.stdout == 'sunny\n' * 3,
+            'roc -u %r' % result.stderr)
+    result = run_roc('-u', 'F1', port, 'nowhere')
+    check(result.returncode == 5, 'roc -u of a missing id')
+    stop_all()
+
+# roc -u gives up on a mapper which does not answer datagrams
+mapper, port = start('mapper2310')
+result = run_roc('-u', 'F1', port, 'sydney')
+check(result.returncode == 4 and
+        result.stderr == 'Failed to connect to mapper\n',
+        'roc -u without a UDP mapper %d' % result.returncode)
+stop_all()
+print('udp ok')
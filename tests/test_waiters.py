@@ -0,0 +1,70 @@
+"""Checks that lookups waiting for an ID to be registered ("?ID:TIMEOUT")
+free their connections when the client goes away, and work for the longest
+IDs roc can ask for."""
+import os
+import socket
+import subprocess
+import threading
+import time
+from common import *
+
+
+def count_sockets(process):
+    directory = '/proc/%d/fd' % process.pid
+    return sum(os.readlink(os.path.join(directory, name)).startswith('socket:')
+            for name in os.listdir(directory))
+
+
+def run_roc(*args):
+    return subprocess.run([os.path.join(BIN_DIR, 'roc2310')] + list(args),
+            capture_output=True, text=True, timeout=20)
+
+
+mapper, port = start('mapper2310')
+connection, file = connect(port)
+check(ask(file, '?nobody') == [';'], 'mapper answering')
+idle = count_sockets(mapper)
+
+# Clients which close with only a FIN, or with a reset, while waiting
+for i in range(50):
+    client = socket.create_connection(('localhost', int(port)))
+    client.send(b'?dropped:60000\n')
+    if i % 2:
+        client.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER,
+                b'\x01\0\0\0\0\0\0\0')
+    client.close()
+# One which only shuts down its sending side
+halfClosed = socket.create_connection(('localhost', int(port)))
+halfClosed.send(b'?dropped:60000\n')
+halfClosed.shutdown(socket.SHUT_WR)
+deadline = time.time() + 5
+while count_sockets(mapper) > idle and time.time() < deadline:
+    time.sleep(0.1)
+check(count_sockets(mapper) == idle,
+        'waiting connections freed (%d sockets, %d idle)' %
+        (count_sockets(mapper), idle))
+halfClosed.settimeout(1)
+check(halfClosed.recv(10) == b'', 'half closed connection closed')
+halfClosed.close()
+check(ask(file, '!dropped:3\n?dropped') == ['3'], 'registered after drops')
+
+# Lookups of the longest ID that a control can register ("!ID:PORT" with a
+# five-digit port), and of one as long as roc allows (so that "&ID" is as
+# long as the mapper accepts), with the longest timeout
+longId = 'L' * 4088
+threading.Timer(0.3, lambda: start('control2310', longId, 'info', port)).start()
+began = time.time()
+result = run_roc('-w', '9999999', 'F1', port, longId)
+check(result.returncode == 0 and result.stdout == 'info\n',
+        'long id waited for %r' % result.stderr)
+check(time.time() - began < 5, 'long id woke the wait')
+result = run_roc('F1', port, 'N' * 4095)
+check(result.returncode == 5, 'too long id rejected %d' % result.returncode)
+check(ask(file, '?%s:0000000' % ('M' * 4094)) == [';'],
+        'longest waiting lookup answered')
+began = time.time()
+result = run_roc('-w', '300', 'F1', port, 'M' * 4094)
+check(result.returncode == 5 and time.time() - began < 2,
+        'long id timed out %d' % result.returncode)
+stop_all()
+print('waiters ok')